@@ -180,6 +180,10 @@ namespace amx {
     size_t _code_count{};
     cell* _data_ptr{};
     size_t _data_count{};
+    size_t _heap_base_count{};
+    // the furthest HEA and STK got since load, see note_memory_use
+    cell _heap_high{};
+    cell _stack_low{};
 
   public:
     amx_t amx{&amx_callback_wrapper, this};
@@ -199,6 +203,13 @@ namespace amx {
       single_step_fn on_single_step;
       break_fn on_break;
       void* user_data;
+      bool retain_function_symbols;
+    };
+
+    struct function_symbol {
+      const char* name;
+      cell codestart;
+      cell codeend;
     };
 
   private:
@@ -217,7 +228,16 @@ namespace amx {
 
     cell _main{};
 
+    function_symbol* _functions_ptr{};
+    size_t _functions_count{};
+
     void* _alloc{};
+    void* _symbols_alloc{};
+
+    // data mappings made through map_data, as DAT relative [begin, end). each one is a single host buffer
+    constexpr static size_t max_mapped_regions = 8;
+    std::pair<cell, cell> _regions[max_mapped_regions]{};
+    size_t _regions_count{};
 
   public:
     cell get_public(const char* v) {
@@ -246,10 +266,96 @@ namespace amx {
       return result == end ? 0 : result->second;
     }
 
+    bool find_pubvar(const char* v, cell& address) {
+      const auto begin = _pubvars_ptr;
+      const auto end = begin + _pubvars_count;
+      const auto result = std::find_if(
+        begin,
+        end,
+        [v](std::pair<const char*, cell>& a) {
+          return 0 == strcmp(v, a.first);
+        });
+
+      if (result == end)
+        return false;
+      address = result->second;
+      return true;
+    }
+
     cell get_main() { return _main; }
 
+    size_t get_publics_count() const { return _publics_count; }
+
+    const std::pair<const char*, cell>& get_public_by_index(size_t i) const { return _publics_ptr[i]; }
+
+    size_t get_functions_count() const { return _functions_count; }
+
+    const function_symbol& get_function_by_index(size_t i) const { return _functions_ptr[i]; }
+
+    const cell* get_data() const { return _data_ptr; }
+
+    size_t get_data_count() const { return _data_count; }
+
+    // whether the module's native table references fn, which is the only way it can ever call it
+    bool uses_native(native_fn fn) const {
+      return std::find(_natives_ptr, _natives_ptr + _natives_count, fn) != _natives_ptr + _natives_count;
+    }
+    size_t get_heap_base_count() const { return _heap_base_count; }
+
+    void get_high_water_marks(cell& heap_high, cell& stack_low) const {
+      heap_high = _heap_high;
+      stack_low = _stack_low;
+    }
+
+    void set_on_single_step(single_step_fn fn) { _on_single_step = fn; }
+
+    bool map_data(cell* host, size_t count, cell& va) {
+      if (_regions_count == max_mapped_regions)
+        return false;
+      if (!amx.mem.data().map(host, count, va))
+        return false;
+      const auto begin = va - amx.DAT;
+      _regions[_regions_count++] = {begin, begin + (cell)(count * sizeof(cell))};
+      return true;
+    }
+
+    void unmap_data(cell va, size_t count) {
+      amx.mem.data().unmap(va, count);
+      const auto begin = va - amx.DAT;
+      for (size_t i = 0; i < _regions_count; ++i) {
+        if (_regions[i].first == begin) {
+          _regions[i] = _regions[--_regions_count];
+          break;
+        }
+      }
+    }
+
+    // whether [addr, addr + size) lies within the data segment or within one mapping made with map_data, and so is
+    // backed by a single host buffer. size must be nonzero
+    bool is_single_region(cell addr, cell size) const {
+      if (size > (cell)~addr)
+        return false;
+      const auto end = addr + size;
+      if (end <= (cell)(_data_count * sizeof(cell)))
+        return true;
+      for (size_t i = 0; i < _regions_count; ++i)
+        if (addr >= _regions[i].first && end <= _regions[i].second)
+          return true;
+      return false;
+    }
+
   private:
+    // The engine's opcode handlers are out of reach, so HEA and STK are sampled whenever it calls back: at every native
+    // call, and at every instruction while a single step hook is installed.
+    FORCEINLINE void note_memory_use() {
+      if (amx.HEA > _heap_high)
+        _heap_high = amx.HEA;
+      if (amx.STK < _stack_low)
+        _stack_low = amx.STK;
+    }
+
     error amx_callback(cell index, cell stk, cell& pri) {
+      note_memory_use();
       if (index == amx_t::cbid_single_step)
         return _on_single_step ? _on_single_step(&amx, this, _callback_user_data) : error::success;
       if (index == amx_t::cbid_break)
@@ -266,6 +372,141 @@ namespace amx {
       return ((loader*)user_data)->amx_callback(index, stk, pri);
     }
 
+    // Walks the tables of the debug chunk, calling fn for every function symbol. Returns false unless the tables add
+    // up to exactly the chunk size, which is also how the header with a 32-bit line count is told apart from the older
+    // one with a 16-bit count.
+    template <typename Fn>
+    static bool walk_debug_info(const uint8_t* begin, const uint8_t* end, bool wide_lines, Fn fn) {
+      using namespace detail;
+
+      constexpr static uint8_t ident_function = 9;
+
+      auto it = begin;
+      const auto take = [&](size_t count, size_t entry_size) -> const uint8_t* {
+        if (count > (size_t)(end - it) / entry_size)
+          return nullptr;
+        const auto p = it;
+        it += count * entry_size;
+        return p;
+      };
+      const auto take_string = [&]() -> const char* {
+        const auto p = it;
+        while (it < end && *it)
+          ++it;
+        if (it == end)
+          return nullptr;
+        ++it;
+        return (const char*)p;
+      };
+
+      const auto hdr = take(1, wide_lines ? 24 : 22);
+      if (!hdr || read_le<uint16_t>(hdr + 4) != 0xF1EF)
+        return false;
+      const size_t files = read_le<uint16_t>(hdr + 10);
+      const size_t lines = wide_lines ? read_le<uint32_t>(hdr + 12) : read_le<uint16_t>(hdr + 12);
+      const auto counts = hdr + (wide_lines ? 16 : 14);
+      const size_t symbols = read_le<uint16_t>(counts);
+      const size_t tags = read_le<uint16_t>(counts + 2);
+      const size_t automatons = read_le<uint16_t>(counts + 4);
+      const size_t states = read_le<uint16_t>(counts + 6);
+
+      for (size_t i = 0; i < files; ++i)
+        if (!take(1, sizeof(cell)) || !take_string())
+          return false;
+
+      if (lines && !take(lines, sizeof(cell) + 4))
+        return false;
+
+      for (size_t i = 0; i < symbols; ++i) {
+        // address, tag, codestart, codeend, ident, vclass, dim
+        const auto sym = take(1, sizeof(cell) * 3 + 6);
+        const auto name = sym ? take_string() : nullptr;
+        if (!name)
+          return false;
+        const auto codestart = read_le<cell>(sym + sizeof(cell) + 2);
+        const auto codeend = read_le<cell>(sym + sizeof(cell) * 2 + 2);
+        const auto ident = sym[sizeof(cell) * 3 + 2];
+        const size_t dim = read_le<uint16_t>(sym + sizeof(cell) * 3 + 4);
+        if (dim && !take(dim, sizeof(cell) + 2))
+          return false;
+        if (ident == ident_function)
+          fn(name, codestart, codeend);
+      }
+
+      for (size_t i = 0; i < tags; ++i)
+        if (!take(1, 2) || !take_string())
+          return false;
+
+      for (size_t i = 0; i < automatons; ++i)
+        if (!take(1, sizeof(cell) + 2) || !take_string())
+          return false;
+
+      for (size_t i = 0; i < states; ++i)
+        if (!take(1, 4) || !take_string())
+          return false;
+
+      return it == end;
+    }
+
+    void load_function_symbols(const uint8_t* buf, size_t buf_size, size_t amx_size) {
+      using namespace detail;
+
+      if (buf_size - amx_size < 4)
+        return;
+      const auto begin = buf + amx_size;
+      const auto dbg_size = read_le<uint32_t>(begin);
+      if (dbg_size > buf_size - amx_size)
+        return;
+      const auto end = begin + dbg_size;
+
+      size_t count{};
+      size_t string_buffer_size{};
+      const auto counter = [&](const char* name, cell, cell) {
+        ++count;
+        string_buffer_size += strlen(name) + 1;
+      };
+
+      bool wide_lines = false;
+      if (!walk_debug_info(begin, end, wide_lines, counter)) {
+        count = string_buffer_size = 0;
+        wide_lines = true;
+        if (!walk_debug_info(begin, end, wide_lines, counter))
+          return;
+      }
+
+      if (!count)
+        return;
+
+      const auto table_size = align_up(count * sizeof(function_symbol), MEMORY_ALLOCATION_ALIGNMENT);
+      const auto alloc = ExAllocatePoolZero(NonPagedPoolNx, table_size + string_buffer_size, 'LxmA');
+      if (!alloc)
+        return;
+
+      _symbols_alloc = alloc;
+      _functions_ptr = (function_symbol*)alloc;
+
+      auto string_buffer = (char*)alloc + table_size;
+      size_t counter_idx{};
+      walk_debug_info(
+        begin,
+        end,
+        wide_lines,
+        [&](const char* name, cell codestart, cell codeend) {
+          const auto len = strlen(name) + 1;
+          memcpy(string_buffer, name, len);
+          _functions_ptr[counter_idx++] = {string_buffer, codestart, codeend};
+          string_buffer += len;
+        }
+      );
+      _functions_count = counter_idx;
+
+      std::sort(
+        _functions_ptr,
+        _functions_ptr + _functions_count,
+        [](const function_symbol& a, const function_symbol& b) { return a.codestart < b.codestart; }
+      );
+    }
+
   public:
     loader_error init(const uint8_t* buf, size_t buf_size, const callbacks_arg& callbacks) {
       static_assert(expected_magic != 0, "unsupported cell size");
@@ -468,6 +709,8 @@ namespace amx {
       for (size_t i = 0; i < _code_count; ++i)
         _data_ptr[i] = from_le(_data_ptr[i]);
 
+      _heap_base_count = data_count;
+
       cell code_base{};
       bool result = amx.mem.code().map(_code_ptr, _code_count, code_base);
       if (!result)
@@ -581,6 +824,59 @@ namespace amx {
 
       amx.STK = amx.STP = (cell)((_data_count - 1) * sizeof(cell));
       amx.HEA = (cell)(data_count * sizeof(cell));
+      _heap_high = amx.HEA;
+      _stack_low = amx.STK;
+
+      // optional, a module with broken debug info still loads, just without names
+      if ((flags & flag_debug) && callbacks.retain_function_symbols)
+        load_function_symbols(buf, buf_size, size);
+
+      return loader_error::success;
+    }
+
+    // Sets this loader up as another instance of an already initialized one. Code and all tables are shared with other,
+    // which must outlive this one; only the data section is copied, in whatever state other has it right now. The copy
+    // goes into data_alloc, which must hold get_data_count() cells and is owned by this loader from here on, so that
+    // the caller decides where it lives.
+    loader_error init_clone(const loader& other, void* user_data, void* data_alloc) {
+      _on_single_step = other._on_single_step;
+      _on_break = other._on_break;
+      _callback_user_data = user_data;
+
+      _natives_ptr = other._natives_ptr;
+      _natives_count = other._natives_count;
+      _publics_ptr = other._publics_ptr;
+      _publics_count = other._publics_count;
+      _pubvars_ptr = other._pubvars_ptr;
+      _pubvars_count = other._pubvars_count;
+      _functions_ptr = other._functions_ptr;
+      _functions_count = other._functions_count;
+      _main = other._main;
+
+      _code_ptr = other._code_ptr;
+      _code_count = other._code_count;
+      _heap_base_count = other._heap_base_count;
+
+      _alloc = data_alloc;
+      _data_ptr = (cell*)data_alloc;
+      _data_count = other._data_count;
+      memcpy(_data_ptr, other._data_ptr, _data_count * sizeof(cell));
+
+      cell code_base{};
+      if (!amx.mem.code().map(_code_ptr, _code_count, code_base))
+        return loader_error::unknown;
+
+      cell data_base{};
+      if (!amx.mem.data().map(_data_ptr, _data_count, data_base))
+        return loader_error::unknown;
+
+      amx.COD = code_base;
+      amx.DAT = data_base;
+      amx.STK = other.amx.STK;
+      amx.STP = other.amx.STP;
+      amx.HEA = other.amx.HEA;
+      _heap_high = amx.HEA;
+      _stack_low = amx.STK;
 
       return loader_error::success;
     }
@@ -592,6 +888,8 @@ namespace amx {
     }
 
     ~loader() {
+      if (_symbols_alloc)
+        ExFreePool(_symbols_alloc);
       if (_alloc)
         ExFreePool(_alloc);
     }
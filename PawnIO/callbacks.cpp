@@ -105,6 +105,11 @@ struct callback_list<Ret(*)(Args...)> {
     l.erase(l.citer_from_entry((PLIST_ENTRY)cookie));
   }
 
+  FORCEINLINE bool empty() {
+    std::shared_lock lock{res};
+    return list.get().empty();
+  }
+
   FORCEINLINE NTSTATUS call_status(Args... args)
     requires(std::is_same_v<Ret, NTSTATUS>) {
     std::shared_lock lock{res};
@@ -174,6 +179,10 @@ void vm_callback_destroyed(PVOID ctx) {
   s_destroyed.call_void(ctx);
 }
 
+bool vm_callback_has_call_hooks() {
+  return !s_precall.empty() || !s_postcall.empty();
+}
+
 PVOID pawnio_register_vm_callback_created(ppawnio_vm_callback_created callback) {
   return s_created.add(callback);
 }
@@ -56,3 +56,4 @@ NTSTATUS vm_callback_created(PVOID ctx);
 NTSTATUS vm_callback_precall(PVOID ctx, cell_t cip);  // Use cell_t for architecture compatibility
 void vm_callback_postcall(PVOID ctx);
 void vm_callback_destroyed(PVOID ctx);
+bool vm_callback_has_call_hooks();
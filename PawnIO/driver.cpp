@@ -57,6 +57,198 @@ ULONG pawnio_version() {
 }
 
 static NTSTATUS dispatch_irp(PDEVICE_OBJECT device_object, PIRP irp);
+static NTSTATUS dispatch_irp_sync(PIRP irp);
+
+// Calls into a VM from handles opened for overlapped I/O are pended and run on a fixed set of worker threads, so that
+// a slow module doesn't hold up the caller. The queue is cancel-safe, and bounded so a client can't pile up IRPs.
+// Workers only take an IRP whose handle has an instance to spare, so one busy handle can't have every worker waiting
+// on its locks; the handle's calls in flight are counted in its file object's FsContext2, and the number it may have
+// is kept in the IRP's first DriverContext. A worker runs the call attached to the caller's process and on the
+// caller's NUMA node, kept in the second DriverContext, so that natives and vm_pool_acquire see the same process and
+// node they would have without the queue.
+constexpr static size_t k_async_max_workers = 8;
+constexpr static LONG k_async_max_queued = 1024;
+
+struct async_queue {
+  IO_CSQ csq;
+  LIST_ENTRY list;
+  KSPIN_LOCK lock;
+  LONG queued;
+  // released once for every IRP queued, and once for every worker on shutdown
+  KSEMAPHORE semaphore;
+  volatile bool stopping;
+  PETHREAD workers[k_async_max_workers];
+  size_t worker_count;
+};
+
+static async_queue s_async;
+
+static volatile LONG_PTR* async_in_flight(PIRP irp) {
+  return (volatile LONG_PTR*)&IoGetCurrentIrpStackLocation(irp)->FileObject->FsContext2;
+}
+
+static NTSTATUS async_csq_insert(PIO_CSQ csq, PIRP irp, PVOID insert_context) {
+  UNREFERENCED_PARAMETER(csq);
+  UNREFERENCED_PARAMETER(insert_context);
+  if (s_async.queued >= k_async_max_queued)
+    return STATUS_DEVICE_BUSY;
+  ++s_async.queued;
+  InsertTailList(&s_async.list, &irp->Tail.Overlay.ListEntry);
+  return STATUS_SUCCESS;
+}
+
+// whatever takes an IRP off the queue, a worker or a cancel, counts it in flight until it's completed
+static void async_csq_remove(PIO_CSQ csq, PIRP irp) {
+  UNREFERENCED_PARAMETER(csq);
+  --s_async.queued;
+  RemoveEntryList(&irp->Tail.Overlay.ListEntry);
+  InterlockedIncrementSizeT((volatile SIZE_T*)async_in_flight(irp));
+}
+
+static void async_complete(PIRP irp) {
+  InterlockedDecrementSizeT((volatile SIZE_T*)async_in_flight(irp));
+  IoCompleteRequest(irp, IO_NO_INCREMENT);
+}
+
+// peek_context is a file object to only look at its IRPs, or null for any whose handle has a free instance
+static PIRP async_csq_peek_next(PIO_CSQ csq, PIRP irp, PVOID peek_context) {
+  UNREFERENCED_PARAMETER(csq);
+  const auto head = &s_async.list;
+  for (auto entry = irp ? irp->Tail.Overlay.ListEntry.Flink : head->Flink; entry != head; entry = entry->Flink) {
+    const auto next = CONTAINING_RECORD(entry, IRP, Tail.Overlay.ListEntry);
+    if (peek_context) {
+      if (IoGetCurrentIrpStackLocation(next)->FileObject == peek_context)
+        return next;
+    } else if (*async_in_flight(next) < (LONG_PTR)next->Tail.Overlay.DriverContext[0]) {
+      return next;
+    }
+  }
+  return nullptr;
+}
+
+static void async_csq_acquire(PIO_CSQ csq, PKIRQL irql) {
+  UNREFERENCED_PARAMETER(csq);
+  KeAcquireSpinLock(&s_async.lock, irql);
+}
+
+static void async_csq_release(PIO_CSQ csq, KIRQL irql) {
+  UNREFERENCED_PARAMETER(csq);
+  KeReleaseSpinLock(&s_async.lock, irql);
+}
+
+static void async_csq_complete_canceled(PIO_CSQ csq, PIRP irp) {
+  UNREFERENCED_PARAMETER(csq);
+  irp->IoStatus.Status = STATUS_CANCELLED;
+  irp->IoStatus.Information = 0;
+  async_complete(irp);
+}
+
+static void async_worker(PVOID context) {
+  UNREFERENCED_PARAMETER(context);
+  while (true) {
+    KeWaitForSingleObject(&s_async.semaphore, Executive, KernelMode, FALSE, nullptr);
+    if (s_async.stopping)
+      break;
+    // may have been cancelled since it was queued, or only be queued for handles that are busy. those are picked up
+    // once a call on them is done
+    const auto irp = IoCsqRemoveNextIrp(&s_async.csq, nullptr);
+    if (!irp)
+      continue;
+    irp->IoStatus.Information = 0;
+    KAPC_STATE apc_state{};
+    const auto process = IoGetRequestorProcess(irp);
+    if (process)
+      KeStackAttachProcess(process, &apc_state);
+    GROUP_AFFINITY affinity{}, old_affinity{};
+    KeQueryNodeActiveAffinity((USHORT)(ULONG_PTR)irp->Tail.Overlay.DriverContext[1], &affinity, nullptr);
+    // a node without active processors keeps whatever the worker had
+    if (affinity.Mask)
+      KeSetSystemGroupAffinityThread(&affinity, &old_affinity);
+    irp->IoStatus.Status = dispatch_irp_sync(irp);
+    if (affinity.Mask)
+      KeRevertToUserGroupAffinityThread(&old_affinity);
+    if (process)
+      KeUnstackDetachProcess(&apc_state);
+    async_complete(irp);
+    if (s_async.queued != 0)
+      KeReleaseSemaphore(&s_async.semaphore, IO_NO_INCREMENT, 1, FALSE);
+  }
+  PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+static void async_stop() {
+  s_async.stopping = true;
+  KeReleaseSemaphore(&s_async.semaphore, IO_NO_INCREMENT, (LONG)s_async.worker_count, FALSE);
+  for (size_t i = 0; i < s_async.worker_count; ++i) {
+    KeWaitForSingleObject(s_async.workers[i], Executive, KernelMode, FALSE, nullptr);
+    ObDereferenceObject(s_async.workers[i]);
+  }
+  s_async.worker_count = 0;
+}
+
+static NTSTATUS async_start() {
+  InitializeListHead(&s_async.list);
+  KeInitializeSpinLock(&s_async.lock);
+  KeInitializeSemaphore(&s_async.semaphore, 0, MAXLONG);
+  auto status = IoCsqInitializeEx(
+    &s_async.csq,
+    &async_csq_insert,
+    &async_csq_remove,
+    &async_csq_peek_next,
+    &async_csq_acquire,
+    &async_csq_release,
+    &async_csq_complete_canceled
+  );
+  if (!NT_SUCCESS(status))
+    return status;
+
+  const auto count = std::min((size_t)KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS), k_async_max_workers);
+  // DriverEntry runs in System, but the handles are kernel ones regardless, same as the VM's threads
+  OBJECT_ATTRIBUTES attributes;
+  InitializeObjectAttributes(&attributes, nullptr, OBJ_KERNEL_HANDLE, nullptr, nullptr);
+  for (size_t i = 0; i < count; ++i) {
+    HANDLE thread{};
+    status = PsCreateSystemThread(&thread, THREAD_ALL_ACCESS, &attributes, nullptr, nullptr, &async_worker, nullptr);
+    if (!NT_SUCCESS(status))
+      break;
+    status = ObReferenceObjectByHandle(
+      thread,
+      THREAD_ALL_ACCESS,
+      *PsThreadType,
+      KernelMode,
+      (PVOID*)&s_async.workers[i],
+      nullptr
+    );
+    if (!NT_SUCCESS(status)) {
+      // can't wait for it without the object, let it see the flag on its own
+      s_async.stopping = true;
+      KeReleaseSemaphore(&s_async.semaphore, IO_NO_INCREMENT, 1, FALSE);
+      ZwWaitForSingleObject(thread, FALSE, nullptr);
+      ZwClose(thread);
+      break;
+    }
+    ZwClose(thread);
+    ++s_async.worker_count;
+  }
+
+  if (!NT_SUCCESS(status))
+    async_stop();
+  return status;
+}
+
+// only calls into a VM are worth a trip to a worker
+static bool async_should_queue(PIO_STACK_LOCATION irp_stack) {
+  if (irp_stack->FileObject->Flags & FO_SYNCHRONOUS_IO)
+    return false;
+  switch (irp_stack->Parameters.DeviceIoControl.IoControlCode) {
+  case IOCTL_PIO_EXECUTE_FN:
+  case IOCTL_PIO_EXECUTE_FN_BY_ID:
+  case IOCTL_PIO_EXECUTE_BATCH:
+    return true;
+  default:
+    return false;
+  }
+}
 
 static void driver_unload(PDRIVER_OBJECT driver_object) {
   const auto device_object = driver_object->DeviceObject;
@@ -64,6 +256,8 @@ static void driver_unload(PDRIVER_OBJECT driver_object) {
   if (device_object)
     IoDeleteDevice(device_object);
 
+  async_stop();
+  vm_ring_destroy();
   vm_callback_destroy();
 }
 
@@ -96,32 +290,44 @@ EXTERN_C NTSTATUS DriverEntry(PDRIVER_OBJECT driver_object, PUNICODE_STRING regi
 
   auto status = vm_callback_init();
   if (NT_SUCCESS(status)) {
-    UNICODE_STRING device_path = RTL_CONSTANT_STRING(k_device_path);
-    UNICODE_STRING sddl;
-    RtlInitUnicodeString(&sddl, L"D:P(A;;GA;;;SY)(A;;GA;;;BA)");
-    PDEVICE_OBJECT device_object = nullptr;
-    status = IoCreateDeviceSecure(
-      driver_object,
-      0,
-      &device_path,
-      k_device_type,
-      0,
-      FALSE,
-      &sddl,
-      &k_device_class,
-      &device_object
-    );
-
+    status = vm_ring_init();
     if (NT_SUCCESS(status)) {
-      driver_object->DriverUnload = driver_unload;
+      UNICODE_STRING device_path = RTL_CONSTANT_STRING(k_device_path);
+      UNICODE_STRING sddl;
+      RtlInitUnicodeString(&sddl, L"D:P(A;;GA;;;SY)(A;;GA;;;BA)");
+      PDEVICE_OBJECT device_object = nullptr;
+      status = IoCreateDeviceSecure(
+        driver_object,
+        0,
+        &device_path,
+        k_device_type,
+        0,
+        FALSE,
+        &sddl,
+        &k_device_class,
+        &device_object
+      );
+
+      if (NT_SUCCESS(status))
+        status = async_start();
 
-      driver_object->MajorFunction[IRP_MJ_CREATE] = dispatch_irp;
-      driver_object->MajorFunction[IRP_MJ_CLOSE] = dispatch_irp;
-      driver_object->MajorFunction[IRP_MJ_DEVICE_CONTROL] = dispatch_irp;
+      if (NT_SUCCESS(status)) {
+        driver_object->DriverUnload = driver_unload;
 
-      device_object->Flags &= ~DO_DEVICE_INITIALIZING;
+        driver_object->MajorFunction[IRP_MJ_CREATE] = dispatch_irp;
+        driver_object->MajorFunction[IRP_MJ_CLEANUP] = dispatch_irp;
+        driver_object->MajorFunction[IRP_MJ_CLOSE] = dispatch_irp;
+        driver_object->MajorFunction[IRP_MJ_DEVICE_CONTROL] = dispatch_irp;
 
-      return status;
+        device_object->Flags &= ~DO_DEVICE_INITIALIZING;
+
+        return status;
+      }
+
+      if (device_object)
+        IoDeleteDevice(device_object);
+
+      vm_ring_destroy();
     }
 
     vm_callback_destroy();
@@ -137,6 +343,32 @@ NTSTATUS dispatch_irp(PDEVICE_OBJECT device_object, PIRP irp) {
 
   const auto irp_stack = IoGetCurrentIrpStackLocation(irp);
 
+  if (irp_stack->MajorFunction == IRP_MJ_DEVICE_CONTROL && async_should_queue(irp_stack)) {
+    irp->Tail.Overlay.DriverContext[0] = (PVOID)vm_concurrency(irp_stack->FileObject->FsContext);
+    irp->Tail.Overlay.DriverContext[1] = (PVOID)(ULONG_PTR)KeGetCurrentNodeNumber();
+    const auto status = IoCsqInsertIrpEx(&s_async.csq, irp, nullptr, nullptr);
+    if (NT_SUCCESS(status)) {
+      KeReleaseSemaphore(&s_async.semaphore, IO_NO_INCREMENT, 1, FALSE);
+      return STATUS_PENDING;
+    }
+    irp->IoStatus.Status = status;
+    IoCompleteRequest(irp, IO_NO_INCREMENT);
+    return status;
+  }
+
+  const auto status = dispatch_irp_sync(irp);
+
+  irp->IoStatus.Status = status;
+
+  IoCompleteRequest(irp, IO_NO_INCREMENT);
+
+  return status;
+}
+
+// handles irp and returns its status, but leaves completing it to the caller
+static NTSTATUS dispatch_irp_sync(PIRP irp) {
+  const auto irp_stack = IoGetCurrentIrpStackLocation(irp);
+
   auto status = STATUS_NOT_IMPLEMENTED;
 
   switch (irp_stack->MajorFunction) {
@@ -144,6 +376,16 @@ NTSTATUS dispatch_irp(PDEVICE_OBJECT device_object, PIRP irp) {
     status = STATUS_SUCCESS;
     break;
 
+  case IRP_MJ_CLEANUP:
+    // whatever the last handle left queued is not going to be waited for
+    while (const auto queued = IoCsqRemoveNextIrp(&s_async.csq, irp_stack->FileObject))
+      async_csq_complete_canceled(&s_async.csq, queued);
+    // the ring's locked pages must not outlive the process, which may exit well before the close
+    if (irp_stack->FileObject->FsContext)
+      vm_ring_cleanup(irp_stack->FileObject->FsContext);
+    status = STATUS_SUCCESS;
+    break;
+
   case IRP_MJ_CLOSE:
     if (irp_stack->FileObject->FsContext)
       vm_destroy(irp_stack->FileObject->FsContext);
@@ -176,15 +418,286 @@ NTSTATUS dispatch_irp(PDEVICE_OBJECT device_object, PIRP irp) {
       if (!irp_stack->FileObject->FsContext) {
         status = STATUS_INVALID_PARAMETER;
       } else {
+        // only what the public filled gets copied back
+        SIZE_T written{};
         status = vm_execute_function(
           irp_stack->FileObject->FsContext,
           irp->AssociatedIrp.SystemBuffer,
           irp_stack->Parameters.DeviceIoControl.InputBufferLength,
           irp->AssociatedIrp.SystemBuffer,
-          irp_stack->Parameters.DeviceIoControl.OutputBufferLength
+          irp_stack->Parameters.DeviceIoControl.OutputBufferLength,
+          &written
+        );
+        if (NT_SUCCESS(status))
+          irp->IoStatus.Information = written;
+      }
+      break;
+
+    case IOCTL_PIO_EXECUTE_FN_BY_ID:
+      if (!irp_stack->FileObject->FsContext) {
+        status = STATUS_INVALID_PARAMETER;
+      } else {
+        // only what the public filled gets copied back
+        SIZE_T written{};
+        status = vm_execute_function_by_id(
+          irp_stack->FileObject->FsContext,
+          irp->AssociatedIrp.SystemBuffer,
+          irp_stack->Parameters.DeviceIoControl.InputBufferLength,
+          irp->AssociatedIrp.SystemBuffer,
+          irp_stack->Parameters.DeviceIoControl.OutputBufferLength,
+          &written
+        );
+        if (NT_SUCCESS(status))
+          irp->IoStatus.Information = written;
+      }
+      break;
+
+    case IOCTL_PIO_EXECUTE_BATCH:
+      if (!irp_stack->FileObject->FsContext) {
+        status = STATUS_INVALID_PARAMETER;
+      } else {
+        // only up to the furthest output a call filled gets copied back
+        SIZE_T written{};
+        status = vm_execute_batch(
+          irp_stack->FileObject->FsContext,
+          irp->AssociatedIrp.SystemBuffer,
+          irp_stack->Parameters.DeviceIoControl.InputBufferLength,
+          irp->AssociatedIrp.SystemBuffer,
+          irp_stack->Parameters.DeviceIoControl.OutputBufferLength,
+          &written
         );
         if (NT_SUCCESS(status))
-          irp->IoStatus.Information = irp_stack->Parameters.DeviceIoControl.OutputBufferLength;
+          irp->IoStatus.Information = written;
+      }
+      break;
+
+    case IOCTL_PIO_RING_REGISTER:
+      if (!irp_stack->FileObject->FsContext) {
+        status = STATUS_INVALID_PARAMETER;
+      } else if (irp_stack->Parameters.DeviceIoControl.InputBufferLength != sizeof(pio_ring_register)) {
+        status = STATUS_INVALID_PARAMETER;
+      } else {
+        status = vm_ring_register(
+          irp_stack->FileObject->FsContext,
+          (const pio_ring_register*)irp->AssociatedIrp.SystemBuffer
+        );
+      }
+      break;
+
+    case IOCTL_PIO_RING_ENTER:
+      if (!irp_stack->FileObject->FsContext) {
+        status = STATUS_INVALID_PARAMETER;
+      } else {
+        ULONG completed{};
+        status = vm_ring_enter(irp_stack->FileObject->FsContext, &completed);
+        if (NT_SUCCESS(status) && irp_stack->Parameters.DeviceIoControl.OutputBufferLength >= sizeof(ULONG)) {
+          *(ULONG*)irp->AssociatedIrp.SystemBuffer = completed;
+          irp->IoStatus.Information = sizeof(ULONG);
+        }
+      }
+      break;
+
+    case IOCTL_PIO_JOB_REGISTER:
+      if (!irp_stack->FileObject->FsContext) {
+        status = STATUS_INVALID_PARAMETER;
+      } else if (irp_stack->Parameters.DeviceIoControl.OutputBufferLength != sizeof(ULONG)) {
+        status = STATUS_INVALID_PARAMETER;
+      } else {
+        ULONG job_index{};
+        status = vm_job_register(
+          irp_stack->FileObject->FsContext,
+          irp->AssociatedIrp.SystemBuffer,
+          irp_stack->Parameters.DeviceIoControl.InputBufferLength,
+          &job_index
+        );
+        if (NT_SUCCESS(status)) {
+          *(ULONG*)irp->AssociatedIrp.SystemBuffer = job_index;
+          irp->IoStatus.Information = sizeof(ULONG);
+        }
+      }
+      break;
+
+    case IOCTL_PIO_JOB_UNREGISTER:
+      if (!irp_stack->FileObject->FsContext) {
+        status = STATUS_INVALID_PARAMETER;
+      } else if (irp_stack->Parameters.DeviceIoControl.InputBufferLength != sizeof(ULONG)) {
+        status = STATUS_INVALID_PARAMETER;
+      } else {
+        status = vm_job_unregister(
+          irp_stack->FileObject->FsContext,
+          *(ULONG*)irp->AssociatedIrp.SystemBuffer
+        );
+      }
+      break;
+
+    case IOCTL_PIO_LOG_CONTROL:
+      if (!irp_stack->FileObject->FsContext) {
+        status = STATUS_INVALID_PARAMETER;
+      } else if (irp_stack->Parameters.DeviceIoControl.InputBufferLength != sizeof(pio_log_control)) {
+        status = STATUS_INVALID_PARAMETER;
+      } else {
+        status = vm_log_control(
+          irp_stack->FileObject->FsContext,
+          (const pio_log_control*)irp->AssociatedIrp.SystemBuffer
+        );
+      }
+      break;
+
+    case IOCTL_PIO_LOG_QUERY:
+      if (!irp_stack->FileObject->FsContext) {
+        status = STATUS_INVALID_PARAMETER;
+      } else {
+        SIZE_T written{};
+        status = vm_log_query(
+          irp_stack->FileObject->FsContext,
+          irp->AssociatedIrp.SystemBuffer,
+          irp_stack->Parameters.DeviceIoControl.InputBufferLength,
+          irp_stack->Parameters.DeviceIoControl.OutputBufferLength,
+          &written
+        );
+        irp->IoStatus.Information = written;
+      }
+      break;
+
+    case IOCTL_PIO_JOB_QUERY:
+      if (!irp_stack->FileObject->FsContext) {
+        status = STATUS_INVALID_PARAMETER;
+      } else {
+        SIZE_T written{};
+        status = vm_job_query(
+          irp_stack->FileObject->FsContext,
+          irp->AssociatedIrp.SystemBuffer,
+          irp_stack->Parameters.DeviceIoControl.OutputBufferLength,
+          &written
+        );
+        irp->IoStatus.Information = written;
+      }
+      break;
+
+    case IOCTL_PIO_FUNCTIONS_QUERY:
+      if (!irp_stack->FileObject->FsContext) {
+        status = STATUS_INVALID_PARAMETER;
+      } else {
+        SIZE_T written{};
+        status = vm_functions_query(
+          irp_stack->FileObject->FsContext,
+          irp->AssociatedIrp.SystemBuffer,
+          irp_stack->Parameters.DeviceIoControl.OutputBufferLength,
+          &written
+        );
+        irp->IoStatus.Information = written;
+      }
+      break;
+
+    case IOCTL_PIO_SET_INSTRUCTION_BUDGET:
+      if (!irp_stack->FileObject->FsContext) {
+        status = STATUS_INVALID_PARAMETER;
+      } else if (irp_stack->Parameters.DeviceIoControl.InputBufferLength != sizeof(ULONG64)) {
+        status = STATUS_INVALID_PARAMETER;
+      } else {
+        status = vm_set_instruction_budget(
+          irp_stack->FileObject->FsContext,
+          *(ULONG64*)irp->AssociatedIrp.SystemBuffer
+        );
+      }
+      break;
+
+    case IOCTL_PIO_PROFILE_CONTROL:
+      if (!irp_stack->FileObject->FsContext) {
+        status = STATUS_INVALID_PARAMETER;
+      } else if (irp_stack->Parameters.DeviceIoControl.InputBufferLength != sizeof(ULONG)) {
+        status = STATUS_INVALID_PARAMETER;
+      } else {
+        status = vm_profile_control(
+          irp_stack->FileObject->FsContext,
+          *(ULONG*)irp->AssociatedIrp.SystemBuffer != 0
+        );
+      }
+      break;
+
+    case IOCTL_PIO_PROFILE_QUERY:
+      if (!irp_stack->FileObject->FsContext) {
+        status = STATUS_INVALID_PARAMETER;
+      } else {
+        SIZE_T written{};
+        status = vm_profile_query(
+          irp_stack->FileObject->FsContext,
+          irp->AssociatedIrp.SystemBuffer,
+          irp_stack->Parameters.DeviceIoControl.OutputBufferLength,
+          &written
+        );
+        irp->IoStatus.Information = written;
+      }
+      break;
+
+    case IOCTL_PIO_SAMPLING_CONTROL:
+      if (!irp_stack->FileObject->FsContext) {
+        status = STATUS_INVALID_PARAMETER;
+      } else if (irp_stack->Parameters.DeviceIoControl.InputBufferLength != sizeof(ULONG)) {
+        status = STATUS_INVALID_PARAMETER;
+      } else {
+        status = vm_sampling_control(
+          irp_stack->FileObject->FsContext,
+          *(ULONG*)irp->AssociatedIrp.SystemBuffer
+        );
+      }
+      break;
+
+    case IOCTL_PIO_SAMPLING_QUERY:
+      if (!irp_stack->FileObject->FsContext) {
+        status = STATUS_INVALID_PARAMETER;
+      } else {
+        SIZE_T written{};
+        status = vm_sampling_query(
+          irp_stack->FileObject->FsContext,
+          irp->AssociatedIrp.SystemBuffer,
+          irp_stack->Parameters.DeviceIoControl.OutputBufferLength,
+          &written
+        );
+        irp->IoStatus.Information = written;
+      }
+      break;
+
+    case IOCTL_PIO_SYMBOLS_QUERY:
+      if (!irp_stack->FileObject->FsContext) {
+        status = STATUS_INVALID_PARAMETER;
+      } else {
+        SIZE_T written{};
+        status = vm_symbols_query(
+          irp_stack->FileObject->FsContext,
+          irp->AssociatedIrp.SystemBuffer,
+          irp_stack->Parameters.DeviceIoControl.OutputBufferLength,
+          &written
+        );
+        irp->IoStatus.Information = written;
+      }
+      break;
+
+    case IOCTL_PIO_MEMORY_TRACKING:
+      if (!irp_stack->FileObject->FsContext) {
+        status = STATUS_INVALID_PARAMETER;
+      } else if (irp_stack->Parameters.DeviceIoControl.InputBufferLength != sizeof(ULONG)) {
+        status = STATUS_INVALID_PARAMETER;
+      } else {
+        status = vm_memory_tracking(
+          irp_stack->FileObject->FsContext,
+          *(ULONG*)irp->AssociatedIrp.SystemBuffer != 0
+        );
+      }
+      break;
+
+    case IOCTL_PIO_MEMORY_USAGE:
+      if (!irp_stack->FileObject->FsContext) {
+        status = STATUS_INVALID_PARAMETER;
+      } else {
+        SIZE_T written{};
+        status = vm_memory_usage(
+          irp_stack->FileObject->FsContext,
+          irp->AssociatedIrp.SystemBuffer,
+          irp_stack->Parameters.DeviceIoControl.OutputBufferLength,
+          &written
+        );
+        irp->IoStatus.Information = written;
       }
       break;
 
@@ -206,9 +719,5 @@ NTSTATUS dispatch_irp(PDEVICE_OBJECT device_object, PIRP irp) {
     break;
   }
 
-  irp->IoStatus.Status = status;
-
-  IoCompleteRequest(irp, IO_NO_INCREMENT);
-
   return status;
 }
@@ -52,6 +52,248 @@ constexpr static wchar_t k_device_path[] = L"\\Device\\PawnIO";
 enum : ULONG {
   //IOCTL_PIO_GET_REFCOUNT = CTL_CODE(k_device_type, 0x801, METHOD_BUFFERED, FILE_ANY_ACCESS),
   IOCTL_PIO_LOAD_BINARY = CTL_CODE(k_device_type, 0x821, METHOD_BUFFERED, FILE_ANY_ACCESS),
+  // the execute IOCTLs on a handle opened for overlapped I/O are pended and run on a driver worker thread. that thread
+  // is attached to the caller's process and runs on the caller's NUMA node, but the previous mode is kernel
   IOCTL_PIO_EXECUTE_FN = CTL_CODE(k_device_type, 0x841, METHOD_BUFFERED, FILE_ANY_ACCESS),
-  IOCTL_PIO_VERSION = CTL_CODE(k_device_type, 0x861, METHOD_BUFFERED, FILE_ANY_ACCESS)
+  IOCTL_PIO_VERSION = CTL_CODE(k_device_type, 0x861, METHOD_BUFFERED, FILE_ANY_ACCESS),
+  IOCTL_PIO_SET_INSTRUCTION_BUDGET = CTL_CODE(k_device_type, 0x881, METHOD_BUFFERED, FILE_ANY_ACCESS),
+  IOCTL_PIO_PROFILE_CONTROL = CTL_CODE(k_device_type, 0x8A1, METHOD_BUFFERED, FILE_ANY_ACCESS),
+  IOCTL_PIO_PROFILE_QUERY = CTL_CODE(k_device_type, 0x8C1, METHOD_BUFFERED, FILE_ANY_ACCESS),
+  IOCTL_PIO_SAMPLING_CONTROL = CTL_CODE(k_device_type, 0x8E1, METHOD_BUFFERED, FILE_ANY_ACCESS),
+  IOCTL_PIO_SAMPLING_QUERY = CTL_CODE(k_device_type, 0x901, METHOD_BUFFERED, FILE_ANY_ACCESS),
+  IOCTL_PIO_SYMBOLS_QUERY = CTL_CODE(k_device_type, 0x921, METHOD_BUFFERED, FILE_ANY_ACCESS),
+  IOCTL_PIO_MEMORY_USAGE = CTL_CODE(k_device_type, 0x941, METHOD_BUFFERED, FILE_ANY_ACCESS),
+  IOCTL_PIO_FUNCTIONS_QUERY = CTL_CODE(k_device_type, 0x961, METHOD_BUFFERED, FILE_ANY_ACCESS),
+  IOCTL_PIO_EXECUTE_FN_BY_ID = CTL_CODE(k_device_type, 0x981, METHOD_BUFFERED, FILE_ANY_ACCESS),
+  IOCTL_PIO_EXECUTE_BATCH = CTL_CODE(k_device_type, 0x9A1, METHOD_BUFFERED, FILE_ANY_ACCESS),
+  IOCTL_PIO_RING_REGISTER = CTL_CODE(k_device_type, 0x9C1, METHOD_BUFFERED, FILE_ANY_ACCESS),
+  IOCTL_PIO_RING_ENTER = CTL_CODE(k_device_type, 0x9E1, METHOD_BUFFERED, FILE_ANY_ACCESS),
+  IOCTL_PIO_JOB_REGISTER = CTL_CODE(k_device_type, 0xA01, METHOD_BUFFERED, FILE_ANY_ACCESS),
+  IOCTL_PIO_JOB_UNREGISTER = CTL_CODE(k_device_type, 0xA21, METHOD_BUFFERED, FILE_ANY_ACCESS),
+  IOCTL_PIO_JOB_QUERY = CTL_CODE(k_device_type, 0xA41, METHOD_BUFFERED, FILE_ANY_ACCESS),
+  IOCTL_PIO_LOG_CONTROL = CTL_CODE(k_device_type, 0xAA1, METHOD_BUFFERED, FILE_ANY_ACCESS),
+  IOCTL_PIO_LOG_QUERY = CTL_CODE(k_device_type, 0xAC1, METHOD_BUFFERED, FILE_ANY_ACCESS),
+  // input is a ULONG, nonzero to sample IOCTL_PIO_MEMORY_USAGE's marks at every instruction rather than at native
+  // calls only. costs a hook call per instruction while on
+  IOCTL_PIO_MEMORY_TRACKING = CTL_CODE(k_device_type, 0xAE1, METHOD_BUFFERED, FILE_ANY_ACCESS)
+};
+
+constexpr static ULONG k_profile_opcode_count = 256;
+
+// IOCTL_PIO_PROFILE_QUERY output: this header, then opcode_count ULONG64 opcode counters, then public_count
+// pio_profile_public, then hot_count pio_profile_hot.
+struct pio_profile_header {
+  ULONG64 total_instructions;
+  ULONG64 dropped_hot_samples;
+  ULONG opcode_count;
+  ULONG public_count;
+  ULONG hot_count;
+  ULONG reserved;
+};
+
+struct pio_profile_public {
+  ULONG64 cip;
+  ULONG64 calls;
+  ULONG64 instructions;
+};
+
+struct pio_profile_hot {
+  ULONG64 cip;
+  ULONG64 count;
+};
+
+constexpr static ULONG k_sample_max_frames = 14;
+
+// IOCTL_PIO_SAMPLING_QUERY output: this header, then sample_count pio_sample, oldest first. samples returned are
+// consumed.
+struct pio_sampling_header {
+  ULONG64 total_samples;
+  ULONG64 dropped_samples;
+  ULONG sample_count;
+  ULONG reserved;
+};
+
+struct pio_sample {
+  // KeQueryInterruptTime, 100ns units
+  ULONG64 timestamp;
+  ULONG64 cip;
+  ULONG frame_count;
+  ULONG reserved;
+  // return addresses, innermost first
+  ULONG64 frames[k_sample_max_frames];
+};
+
+// IOCTL_PIO_SYMBOLS_QUERY output: this header, then symbol_count pio_symbol. publics come first and have no known end,
+// then functions from the module's debug information, if it had any, sorted by start.
+struct pio_symbols_header {
+  ULONG symbol_count;
+  ULONG reserved;
+};
+
+struct pio_symbol {
+  ULONG64 codestart;
+  ULONG64 codeend;
+  ULONG is_public;
+  CHAR name[36];
+};
+
+// IOCTL_PIO_MEMORY_USAGE output. all values are byte offsets into the data section. the heap grows up from heap_base,
+// the stack grows down from stack_top, and the high-water marks are the furthest each got since load, over every
+// instance of a pooled module. they're sampled at native calls, and at every instruction while
+// IOCTL_PIO_MEMORY_TRACKING is on; without it, a leaf function that goes deeper than where it calls natives isn't
+// seen.
+struct pio_memory_usage {
+  ULONG64 data_size;
+  ULONG64 heap_base;
+  ULONG64 stack_top;
+  ULONG64 heap_high_water;
+  ULONG64 stack_low_water;
+};
+
+// IOCTL_PIO_FUNCTIONS_QUERY output: this header, then function_count pio_function, one for each ioctl_ public.
+// IOCTL_PIO_EXECUTE_FN_BY_ID takes a ULONG64 id in place of the name that IOCTL_PIO_EXECUTE_FN takes, followed by
+// the same input. IDs stay the same for as long as the module is loaded.
+struct pio_functions_header {
+  ULONG function_count;
+  ULONG reserved;
+};
+
+struct pio_function {
+  ULONG id;
+  CHAR name[32];
+};
+
+constexpr static ULONG k_batch_max_calls = 64;
+
+// IOCTL_PIO_EXECUTE_BATCH input: this header, then call_count pio_batch_call, then the inputs they point to. The calls
+// run in order on one instance of the VM. Output: call_count pio_batch_result, then the outputs the calls point to.
+// Outputs start out zeroed, and the output is only returned up to the end of the furthest one a call filled.
+struct pio_batch_header {
+  ULONG call_count;
+  ULONG reserved;
+};
+
+// id is an ID from IOCTL_PIO_FUNCTIONS_QUERY. offsets are in bytes from the start of the input or output
+// buffer and must be cell aligned, counts are in cells. an output must not overlap the results.
+struct pio_batch_call {
+  ULONG64 id;
+  ULONG in_offset;
+  ULONG in_count;
+  ULONG out_offset;
+  ULONG out_count;
+};
+
+struct pio_batch_result {
+  LONG status;
+  // bytes of output the call filled, see set_output_size. 0 if it failed
+  ULONG out_size;
+};
+
+constexpr static ULONG k_ring_max_entries = 4096;
+
+// IOCTL_PIO_RING_REGISTER input, once per handle. region is a cell aligned buffer of region_size bytes that stays
+// locked and shared with the driver until the handle is cleaned up or the registering process exits, after that the
+// ring no longer runs anything. It holds a pio_ring_header, then sq_entries
+// pio_ring_submission, then cq_entries pio_ring_completion, and the rest is the data area that submissions point
+// into. Both counts must be powers of two. Submissions run on IOCTL_PIO_RING_ENTER, which outputs a ULONG with the
+// number of completions posted, and also every poll_interval_ms if that isn't 0. Each submission is read once, and
+// its slices are copied in and out of kernel memory, so rewriting them while a call runs can't change what it sees.
+struct pio_ring_register {
+  ULONG64 region;
+  ULONG64 region_size;
+  ULONG sq_entries;
+  ULONG cq_entries;
+  ULONG poll_interval_ms;
+  ULONG reserved;
+};
+
+// positions only ever increase and wrap around, entry i lives at index i & (entries - 1)
+struct pio_ring_header {
+  // written by user mode
+  ULONG sq_tail;
+  ULONG cq_head;
+  // written by the driver
+  ULONG sq_head;
+  ULONG cq_tail;
+};
+
+// like pio_batch_call, except that offsets are from the start of the data area
+struct pio_ring_submission {
+  ULONG64 user_data;
+  ULONG64 id;
+  ULONG in_offset;
+  ULONG in_count;
+  ULONG out_offset;
+  ULONG out_count;
+};
+
+struct pio_ring_completion {
+  ULONG64 user_data;
+  LONG status;
+  // bytes of output the call filled, 0 if it failed
+  ULONG out_size;
+};
+
+constexpr static ULONG k_job_max_jobs = 16;
+constexpr static ULONG k_job_max_cells = 32;
+
+// IOCTL_PIO_JOB_REGISTER input: this, then in_count cells of input. Runs the function with the given ID every
+// period_ms until unregistered or the handle is closed, and outputs the job's ULONG index. event is an optional handle
+// to an event that gets signalled when there are new results; only the first one given on a handle is used.
+struct pio_job_register {
+  ULONG64 id;
+  ULONG64 event;
+  ULONG period_ms;
+  ULONG in_count;
+  ULONG out_count;
+  ULONG reserved;
+};
+
+// IOCTL_PIO_JOB_QUERY output: this header, then record_count pio_job_record, oldest first. records are consumed by
+// reading them. when the ring is full the oldest ones are dropped.
+struct pio_jobs_header {
+  ULONG64 total_records;
+  ULONG64 dropped_records;
+  ULONG record_count;
+  ULONG reserved;
+};
+
+struct pio_job_record {
+  ULONG64 timestamp;
+  ULONG job;
+  LONG status;
+  // cells of output the call filled, 0 if it failed
+  ULONG out_count;
+  ULONG reserved;
+  ULONG64 out[k_job_max_cells];
+};
+
+// IOCTL_PIO_LOG_CONTROL input. Until enabled, debug_print goes straight to the kernel debugger as DbgPrint output;
+// once enabled, it goes only to the log ring. max_per_second limits the records of each instance of the module, 0 for
+// no limit.
+struct pio_log_control {
+  ULONG enabled;
+  ULONG max_per_second;
+};
+
+constexpr static ULONG k_log_text_size = 240;
+
+// IOCTL_PIO_LOG_QUERY input is a ULONG64 sequence number to continue from, 0 for the oldest record still around. The
+// output is this header, then record_count pio_log_entry of the module's own records, oldest first. Reading continues
+// from next_sequence. lost_records counts the module's records this handle never got to read, since they were
+// overwritten or dropped, found since the previous query. A record that needed more than the 8 arguments the ring
+// keeps shows its unformatted text behind a marker.
+struct pio_log_header {
+  ULONG64 next_sequence;
+  ULONG64 lost_records;
+  ULONG64 rate_limited_records;
+  ULONG record_count;
+  ULONG reserved;
+};
+
+struct pio_log_entry {
+  ULONG64 sequence;
+  ULONG64 timestamp;
+  // formatted when read, truncated to fit
+  CHAR text[k_log_text_size];
 };
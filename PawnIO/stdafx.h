@@ -57,6 +57,7 @@
 #endif
 
 #include <ntddk.h>
+#include <ntstrsafe.h>
 
 #ifdef ARCH_X86
 #include "wdk_compat.h"
@@ -58,6 +58,7 @@
 
 #include "amx_loader.h"
 #include "callbacks.h"
+#include "ioctl.h"
 #include "natives_impl.h"
 #include "signature.h"
 #include "public.h"
@@ -68,6 +69,40 @@ using amx64_loader = amx::loader<amx64>;
 
 static_assert(std::is_same_v<cell, amx64::cell>, "cell mismatch");
 
+// Translates [addr, addr + count * sizeof(cell)) in one go. Fails if any of it is unmapped or if it straddles two
+// regions: separate mappings are separate host buffers, so only a range within one of them has a single host span.
+static cell* translate_range(amx64_loader* loader, cell addr, size_t count) {
+  if (count == 0 || count > (cell)~(cell)0 / sizeof(cell))
+    return nullptr;
+  if (!loader->is_single_region(addr, (cell)(count * sizeof(cell))))
+    return nullptr;
+  return loader->amx.mem.data().translate(addr);
+}
+
+// Like translate_range, but for data of unknown length (strings): returns the longest mapped prefix of at most
+// max_count cells, and its length in count.
+static cell* translate_prefix(amx64_loader* loader, cell addr, size_t max_count, size_t& count) {
+  count = 0;
+  const auto first = translate_range(loader, addr, 1);
+  if (!first || max_count == 0)
+    return nullptr;
+  if (translate_range(loader, addr, max_count)) {
+    count = max_count;
+    return first;
+  }
+  // valid prefixes are downward closed, so bisect for the longest one
+  size_t lo = 1, hi = max_count - 1;
+  while (lo < hi) {
+    const auto mid = lo + (hi - lo + 1) / 2;
+    if (translate_range(loader, addr, mid))
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  count = lo;
+  return first;
+}
+
 template <typename ArgT, size_t Index>
 class arg_wrapper {};
 
@@ -78,7 +113,7 @@ class arg_wrapper<cell&, Index> {
 public:
   FORCEINLINE arg_wrapper() = default;
 
-  FORCEINLINE amx::error init(amx64* amx, cell, cell argv) {
+  FORCEINLINE amx::error init(amx64* amx, amx64_loader*, cell, cell argv) {
     p = amx->data_v2p(argv + Index * sizeof(cell));
     if (!p)
       return amx::error::access_violation;
@@ -101,7 +136,7 @@ class arg_wrapper<cell, Index> {
 public:
   FORCEINLINE arg_wrapper() = default;
 
-  FORCEINLINE amx::error init(amx64* amx, cell, cell argv) {
+  FORCEINLINE amx::error init(amx64* amx, amx64_loader*, cell, cell argv) {
     const auto p = amx->data_v2p(argv + Index * sizeof(cell));
     if (!p)
       return amx::error::access_violation;
@@ -115,33 +150,27 @@ public:
 
 template <size_t N, size_t Index>
 class arg_wrapper<std::array<cell, N>&, Index> {
-  std::array<cell*, N> ps{};
+  cell* p{};
 
 public:
   FORCEINLINE arg_wrapper() = default;
 
-  FORCEINLINE amx::error init(amx64* amx, cell, cell argv) {
-    const auto p = amx->data_v2p(argv + Index * sizeof(cell));
+  FORCEINLINE amx::error init(amx64* amx, amx64_loader* loader, cell, cell argv) {
+    const auto parr = amx->data_v2p(argv + Index * sizeof(cell));
+    if (!parr)
+      return amx::error::access_violation;
+    p = translate_range(loader, *parr, N);
     if (!p)
       return amx::error::access_violation;
-    const auto arr_base = *p;
-    for (size_t i = 0; i < N; ++i) {
-      const auto elem = amx->mem.data().translate(arr_base + i * sizeof(cell));
-      if (!elem) {
-        ps = {};
-        return amx::error::access_violation;
-      }
-      ps[i] = elem;
-      value[i] = *elem;
-    }
+    memcpy(value.data(), p, sizeof(value));
     return amx::error::success;
   }
 
   std::array<cell, N> value{};
 
   FORCEINLINE ~arg_wrapper() {
-    for (size_t i = 0; i < N; ++i)
-      *(ps[i]) = value[i];
+    if (p)
+      memcpy(p, value.data(), sizeof(value));
   }
 };
 
@@ -150,17 +179,14 @@ class arg_wrapper<std::array<cell, N>, Index> {
 public:
   FORCEINLINE arg_wrapper() = default;
 
-  FORCEINLINE amx::error init(amx64* amx, cell, cell argv) {
-    const auto p = amx->data_v2p(argv + Index * sizeof(cell));
+  FORCEINLINE amx::error init(amx64* amx, amx64_loader* loader, cell, cell argv) {
+    const auto parr = amx->data_v2p(argv + Index * sizeof(cell));
+    if (!parr)
+      return amx::error::access_violation;
+    const auto p = translate_range(loader, *parr, N);
     if (!p)
       return amx::error::access_violation;
-    const auto arr_base = *p;
-    for (size_t i = 0; i < N; ++i) {
-      const auto elem = amx->mem.data().translate(arr_base + i * sizeof(cell));
-      if (!elem)
-        return amx::error::access_violation;
-      value[i] = *elem;
-    }
+    memcpy(value.data(), p, sizeof(value));
     return amx::error::success;
   }
 
@@ -183,22 +209,22 @@ namespace impl {
   using wtuple_t = typename wtuple<std::tuple<Tx...>, std::make_index_sequence<sizeof...(Tx)>>::type;
 
   template <size_t N, typename T>
-  FORCEINLINE amx::error init_wtuple(amx64* amx, cell argc, cell argv, T& tuple) {
+  FORCEINLINE amx::error init_wtuple(amx64* amx, amx64_loader* loader, cell argc, cell argv, T& tuple) {
     if constexpr (N == std::tuple_size_v<T>) {
       return {};
     } else {
       auto& wrapper = std::get<N>(tuple);
-      if (auto err = wrapper.init(amx, argc, argv); err != amx::error::success)
+      if (auto err = wrapper.init(amx, loader, argc, argv); err != amx::error::success)
         return err;
       else
-        return init_wtuple<N + 1, T>(amx, argc, argv, tuple);
+        return init_wtuple<N + 1, T>(amx, loader, argc, argv, tuple);
     }
   }
 
   template <typename... Tx>
-  FORCEINLINE std::pair<wtuple_t<Tx...>, amx::error> init_wtuple(amx64* amx, cell argc, cell argv) {
+  FORCEINLINE std::pair<wtuple_t<Tx...>, amx::error> init_wtuple(amx64* amx, amx64_loader* loader, cell argc, cell argv) {
     std::pair<wtuple_t<Tx...>, amx::error> result = {};
-    result.second = init_wtuple<0>(amx, argc, argv, result.first);
+    result.second = init_wtuple<0>(amx, loader, argc, argv, result.first);
     return result;
   }
 };
@@ -213,13 +239,12 @@ FORCEINLINE amx::error native_callback_wrapper2(
   cell& retval,
   Ret (*)(Args...)
 ) {
-  UNREFERENCED_PARAMETER(loader);
   UNREFERENCED_PARAMETER(user);
 
   if (argc != sizeof...(Args))
     return amx::error::invalid_operand;
 
-  auto&& [wtuple, err] = impl::init_wtuple<Args...>(amx, argc, argv);
+  auto&& [wtuple, err] = impl::init_wtuple<Args...>(amx, loader, argc, argv);
 
   if (err != amx::error::success)
     return err;
@@ -250,31 +275,102 @@ amx::error native_callback_wrapper(amx64* amx, amx64_loader* loader, void* user,
   return native_callback_wrapper2<Fn>(amx, loader, user, argc, argv, retval, Fn);
 }
 
-amx::error debug_print(amx64* amx, amx64_loader* loader, void* user, cell argc, cell argv, cell& retval) {
-  UNREFERENCED_PARAMETER(loader);
-  UNREFERENCED_PARAMETER(user);
+// Packed strings (!"..." in Pawn) hold sizeof(cell) characters per cell, the first one in the most significant byte.
+// They are told apart from unpacked ones by the first cell: an unpacked character never has the top byte set.
+constexpr static cell k_unpacked_max = ((cell)1 << ((sizeof(cell) - 1) * 8)) - 1;
 
-  retval = 0;
+FORCEINLINE static char amx_packed_char(cell c, size_t idx) {
+  return (char)(c >> ((sizeof(cell) - 1 - idx) * 8));
+}
 
-  if (argc == 0)
-    return amx::error::invalid_operand;
-  char message[1024] = "[PawnIO] debug_print: ";
-  cell args[64]{};
-  const auto pvfmt = amx->data_v2p(argv);
-  if (!pvfmt)
-    return amx::error::access_violation;
-  const auto vfmt = *pvfmt;
+static ptrdiff_t amx_strcpy(char* dst, size_t dst_len, amx64_loader* loader, cell vfmt) {
+  // not even room for the terminator
+  if (dst_len == 0)
+    return 0;
+
+  const auto head = translate_range(loader, vfmt, 1);
+  if (!head)
+    return -1;
+
+  if (*head > k_unpacked_max) {
+    const auto max_count = (dst_len + sizeof(cell) - 1) / sizeof(cell);
+    size_t count{};
+    const auto src = translate_prefix(loader, vfmt, max_count, count);
+
+    size_t idx = 0;
+    for (size_t i = 0; i < count; ++i) {
+      const auto packed = src[i];
+      for (size_t j = 0; j < sizeof(cell) && idx < dst_len; ++j, ++idx) {
+        const auto c = amx_packed_char(packed, j);
+        dst[idx] = c;
+        if (!c)
+          return (ptrdiff_t)idx;
+      }
+    }
+
+    // mapping ended before the terminator
+    if (count < max_count)
+      return -1;
+
+    dst[dst_len - 1] = 0;
+    return (ptrdiff_t)dst_len - 1;
+  }
+
+  // anything past dst_len would be truncated anyway
+  size_t count{};
+  const auto src = translate_prefix(loader, vfmt, dst_len, count);
+  if (!src)
+    return -1;
+
+  for (size_t idx = 0; idx < count; ++idx) {
+    const auto c = (char)src[idx];
+    dst[idx] = c;
+    if (!c)
+      return (ptrdiff_t)idx;
+  }
+
+  // mapping ended before the terminator
+  if (count < dst_len)
+    return -1;
+
+  dst[dst_len - 1] = 0;
+  return (ptrdiff_t)dst_len - 1;
+}
+
+// Writes src into the VM as a packed string of at most dst_count cells, truncating it if needed. Returns the number
+// of characters written, or -1 if the buffer isn't mapped.
+static ptrdiff_t amx_strpack(amx64_loader* loader, cell vdst, size_t dst_count, const char* src) {
+  if (dst_count == 0)
+    return 0;
+  const auto dst = translate_range(loader, vdst, dst_count);
+  if (!dst)
+    return -1;
+
+  const auto len = std::min(strlen(src), dst_count * sizeof(cell) - 1);
+  for (size_t i = 0; i * sizeof(cell) <= len; ++i) {
+    cell packed{};
+    for (size_t j = 0; j < sizeof(cell); ++j) {
+      const auto idx = i * sizeof(cell) + j;
+      const auto c = idx < len ? (uint8_t)src[idx] : 0;
+      packed |= (cell)c << ((sizeof(cell) - 1 - j) * 8);
+    }
+    dst[i] = packed;
+  }
+  return (ptrdiff_t)len;
+}
+
+// Turns a debug_print format into a printf one for cell sized arguments, and counts the arguments it takes. Fails on
+// conversions other than %d %i %u %o %x %X and %%, the output is truncated to fit.
+template <size_t N>
+static bool debug_print_format(char (&message)[N], const char* fmt, size_t& arg_count) {
+  message[0] = 0;
   const auto last = std::begin(message) + std::size(message);
-  auto it = message + strlen(message);
-  auto vit = vfmt;
-  size_t arg_count = 0;
+  auto it = message;
+  size_t fmt_idx = 0;
+  arg_count = 0;
   bool in_escape = false;
   while (true) {
-    const auto pc = amx->mem.data().translate(vit);
-    vit += sizeof(cell);
-    if (!pc)
-      return amx::error::access_violation;
-    const auto c = (char)*pc;
+    const auto c = fmt[fmt_idx++];
     char to_cat[10]{};
     if (in_escape)
       switch (c) {
@@ -297,7 +393,7 @@ amx::error debug_print(amx64* amx, amx64_loader* loader, void* user, cell argc,
         in_escape = false;
         break;
       default:
-        return amx::error::invalid_operand;
+        return false;
       }
     else
       switch (c) {
@@ -327,55 +423,10 @@ leave:
     break;
   }
 
-  if (arg_count > argc - 1)
-    return amx::error::invalid_operand;
-
-  if (arg_count > std::size(args))
-    return amx::error::invalid_operand;
-
-  for (size_t i = 0; i < arg_count; ++i) {
-    const auto pparg = amx->data_v2p(argv + (i + 1) * sizeof(cell));
-    if (!pparg)
-      return amx::error::invalid_operand;
-    const auto parg = amx->mem.data().translate(*pparg);
-    if (!parg)
-      return amx::error::invalid_operand;
-    args[i] = *parg;
-  }
-
-  vDbgPrintEx(DPFLTR_DEFAULT_ID, 3, message, (va_list)args);
-  return amx::error::success;
-}
-
-static ptrdiff_t amx_strcpy(char* dst, size_t dst_len, amx64* amx, cell vfmt) {
-  auto vit = vfmt;
-  size_t idx = 0;
-  while (true) {
-    const auto pc = amx->mem.data().translate(vit);
-    vit += sizeof(cell);
-    if (!pc)
-      return -1;
-    const auto c = (char)*pc;
-
-    if (dst_len != 0)
-      dst[idx] = c;
-
-    ++idx;
-
-    if (!c)
-      break;
-
-    if (idx == dst_len) {
-      dst[dst_len - 1] = 0;
-      break;
-    }
-  }
-
-  return (ptrdiff_t)idx - 1;
+  return true;
 }
 
 amx::error get_proc_address_wrap(amx64* amx, amx64_loader* loader, void* user, cell argc, cell argv, cell& retval) {
-  UNREFERENCED_PARAMETER(loader);
   UNREFERENCED_PARAMETER(user);
 
   retval = 0;
@@ -389,7 +440,7 @@ amx::error get_proc_address_wrap(amx64* amx, amx64_loader* loader, void* user, c
     return amx::error::access_violation;
   const auto vfmt = *pvfmt;
 
-  const auto res = amx_strcpy(func_name, std::size(func_name), amx, vfmt);
+  const auto res = amx_strcpy(func_name, std::size(func_name), loader, vfmt);
   if (res == 0)
     return amx::error::invalid_operand;
   if (res == -1)
@@ -414,7 +465,7 @@ amx::error get_public(amx64* amx, amx64_loader* loader, void* user, cell argc, c
     return amx::error::access_violation;
   const auto vfmt = *pvfmt;
 
-  const auto res = amx_strcpy(func_name, std::size(func_name), amx, vfmt);
+  const auto res = amx_strcpy(func_name, std::size(func_name), loader, vfmt);
   if (res == 0)
     return amx::error::invalid_operand;
   if (res == -1)
@@ -425,489 +476,2705 @@ amx::error get_public(amx64* amx, amx64_loader* loader, void* user, cell argc, c
   return amx::error::success;
 }
 
-class wrapped_fast_mutex {
-  FAST_MUTEX _mutex{};
+// reads the arguments of natives that take exactly N cells
+template <size_t N>
+static amx::error native_args(amx64* amx, cell argc, cell argv, cell (&args)[N]) {
+  if (argc != N)
+    return amx::error::invalid_operand;
+  for (size_t i = 0; i < N; ++i) {
+    const auto p = amx->data_v2p(argv + (cell)(i * sizeof(cell)));
+    if (!p)
+      return amx::error::access_violation;
+    args[i] = *p;
+  }
+  return amx::error::success;
+}
 
-public:
-  FORCEINLINE void init() { return ExInitializeFastMutex(&_mutex); }
+// get_public_name(fn, dest[], dest_cells): stores the name of the public at fn into dest as a packed string, returns
+// its length or 0 if fn is not a public
+amx::error get_public_name(amx64* amx, amx64_loader* loader, void* user, cell argc, cell argv, cell& retval) {
+  UNREFERENCED_PARAMETER(user);
 
-  FORCEINLINE void lock() { ExAcquireFastMutex(&_mutex); }
-  FORCEINLINE bool try_lock() { return TRUE == ExTryToAcquireFastMutex(&_mutex); }
-  FORCEINLINE void unlock() { ExReleaseFastMutex(&_mutex); }
-};
+  retval = 0;
 
-struct context {
-  std::aligned_storage_t<sizeof(amx64_loader), alignof(amx64_loader)> loader_storage;
-  amx64_loader* loader;
-  const uint8_t* original_buf;
-  size_t original_buf_size;
-  wrapped_fast_mutex mutex;
-};
+  cell args[3]{};
+  if (const auto err = native_args(amx, argc, argv, args); err != amx::error::success)
+    return err;
+  const auto [fn, vdst, dst_count] = args;
 
-struct to_amx_callback_context {
-  context* ctx;
-  cell cip;
-};
+  for (size_t i = 0; i < loader->get_publics_count(); ++i) {
+    const auto& pub = loader->get_public_by_index(i);
+    if (pub.second != fn)
+      continue;
+    const auto res = amx_strpack(loader, vdst, (size_t)dst_count, pub.first);
+    if (res == -1)
+      return amx::error::access_violation;
+    retval = (cell)res;
+    break;
+  }
 
-constexpr static size_t k_to_amx_callback_count = 0x100;
+  return amx::error::success;
+}
 
-static to_amx_callback_context s_to_amx_callback_data[k_to_amx_callback_count];
+// Block natives: the engine runs MOVS/FILL/CMPS one cell at a time through address translation, these do the same over
+// whole host spans. A range that crosses from one mapping into another (such as the end of an IOCTL window) has no
+// single host span, those fall back to translating every cell.
 
-static __declspec(noinline) cell to_amx_callback_dispatch(size_t idx, cell args) {
-  const auto cb_ctx = &s_to_amx_callback_data[idx];
-  const auto vm_ctx = cb_ctx->ctx;
-  if (!vm_ctx)
-    __fastfail(FAST_FAIL_INVALID_JUMP_BUFFER);
-  std::unique_lock lock{vm_ctx->mutex};
-  const auto cip = cb_ctx->cip;
-  if (!cip)
-    __fastfail(FAST_FAIL_INVALID_JUMP_BUFFER);
-  cell ret{};
-  const auto status = vm_callback_precall(vm_ctx, cip);
-  if (!NT_SUCCESS(status))
-    __fastfail(FAST_FAIL_GUARD_ICALL_CHECK_FAILURE);
-  const auto res = vm_ctx->loader->amx.call(cip, ret, {args});
-  if (res != amx::error::success)
-    __fastfail(FAST_FAIL_INVALID_THREAD_STATE);
-  return ret;
+static amx::error block_args(amx64* amx, cell argc, cell argv, cell (&args)[3]) {
+  if (const auto err = native_args(amx, argc, argv, args); err != amx::error::success)
+    return err;
+  // the count is the last argument for all of them, a range this long would wrap the address space
+  if (args[2] > (cell)~(cell)0 / sizeof(cell))
+    return amx::error::access_violation;
+  return amx::error::success;
 }
 
-template <size_t Idx>
-static cell to_amx_callback(cell first_arg, ...) {
-  va_list va{};
-#ifdef ARCH_X86
-  // x86: use standard va_start with first parameter
-  va_start(va, first_arg);
-#else
-  __va_start(&va, 0); // msvc x64 hack
-#endif
-  const auto args = (cell)va;
-  const auto rv = to_amx_callback_dispatch(Idx, args);
-  return rv;
-}
+// block_copy(dest[], const source[], count): overlapping ranges are handled like memmove
+amx::error block_copy(amx64* amx, amx64_loader* loader, void* user, cell argc, cell argv, cell& retval) {
+  UNREFERENCED_PARAMETER(user);
 
-// Define a type for the callback function pointer
-using to_amx_callback_fn = decltype(&to_amx_callback<0>);
+  retval = 0;
 
-// Helper template to generate the array with all indices
-template <size_t... Indices>
-static constexpr std::array<to_amx_callback_fn, sizeof...(Indices)> make_callback_array(std::index_sequence<Indices...>) {
-  return {&to_amx_callback<Indices>...};
-}
+  cell args[3]{};
+  if (const auto err = block_args(amx, argc, argv, args); err != amx::error::success)
+    return err;
+  const auto [vdst, vsrc, count] = args;
+  if (count == 0)
+    return amx::error::success;
 
-// Generate the array with indices from 0 to k_to_amx_callback_count-1
-static constexpr auto k_to_amx_callback_fns = make_callback_array(std::make_index_sequence<k_to_amx_callback_count>{});
+  const auto dst = translate_range(loader, vdst, (size_t)count);
+  const auto src = translate_range(loader, vsrc, (size_t)count);
+  if (dst && src) {
+    memmove(dst, src, (size_t)count * sizeof(cell));
+    return amx::error::success;
+  }
 
-static cell to_amx_callback_alloc(context* vm_ctx, cell cip) {
-  for (size_t i = 0; i < k_to_amx_callback_count; ++i) {
-    auto& cb_ctx = s_to_amx_callback_data[i];
-    if (cb_ctx.ctx == nullptr) {
-      if (nullptr == _InterlockedCompareExchangePointer((PVOID volatile*)&cb_ctx.ctx, vm_ctx, nullptr)) {
-        cb_ctx.cip = cip;
-        return (cell)k_to_amx_callback_fns[i];
-      }
-    }
+  // validate everything first so a fault doesn't leave a partial copy behind
+  for (cell i = 0; i < count; ++i)
+    if (!amx->mem.data().translate(vdst + i * sizeof(cell)) || !amx->mem.data().translate(vsrc + i * sizeof(cell)))
+      return amx::error::access_violation;
+
+  // virtual addresses only say something about overlap within a mapping, but copying in this direction is never wrong
+  const auto backwards = vdst > vsrc;
+  for (cell n = 0; n < count; ++n) {
+    const auto i = backwards ? count - 1 - n : n;
+    *amx->mem.data().translate(vdst + i * sizeof(cell)) = *amx->mem.data().translate(vsrc + i * sizeof(cell));
   }
-  return 0;
+  return amx::error::success;
 }
 
-static void to_amx_callback_free(context* vm_ctx, cell pfn) {
-  size_t i;
-  for (i = 0; i < k_to_amx_callback_count; ++i)
-    if (pfn == (cell)k_to_amx_callback_fns[i])
-      break;
-  if (i == k_to_amx_callback_count)
-    __fastfail(FAST_FAIL_ASAN_ERROR);
-  auto& cb_ctx = s_to_amx_callback_data[i];
-  if (cb_ctx.ctx != vm_ctx)
-    __fastfail(FAST_FAIL_ASAN_ERROR);
-  cb_ctx.cip = 0;
-  cb_ctx.ctx = nullptr;
-}
+// block_fill(dest[], value, count)
+amx::error block_fill(amx64* amx, amx64_loader* loader, void* user, cell argc, cell argv, cell& retval) {
+  UNREFERENCED_PARAMETER(user);
 
-static amx::error to_amx_callback_alloc_wrap(amx64* amx, amx64_loader* loader, void* user, cell argc, cell argv, cell& retval) {
-  UNREFERENCED_PARAMETER(loader);
+  retval = 0;
 
-  if (argc != 1)
-    return amx::error::invalid_operand;
-  const auto pcip = amx->data_v2p(argv);
-  if (!pcip)
-    return amx::error::access_violation;
-  const auto cip = *pcip;
+  cell args[3]{};
+  if (const auto err = block_args(amx, argc, argv, args); err != amx::error::success)
+    return err;
+  const auto [vdst, value, count] = args;
+  if (count == 0)
+    return amx::error::success;
 
-  retval = to_amx_callback_alloc((context*)user, cip);
+  if (const auto dst = translate_range(loader, vdst, (size_t)count)) {
+    std::fill_n(dst, (size_t)count, value);
+    return amx::error::success;
+  }
 
+  for (cell i = 0; i < count; ++i)
+    if (!amx->mem.data().translate(vdst + i * sizeof(cell)))
+      return amx::error::access_violation;
+
+  for (cell i = 0; i < count; ++i)
+    *amx->mem.data().translate(vdst + i * sizeof(cell)) = value;
   return amx::error::success;
 }
 
-static amx::error to_amx_callback_free_wrap(amx64* amx, amx64_loader* loader, void* user, cell argc, cell argv, cell& retval) {
-  UNREFERENCED_PARAMETER(loader);
+// block_compare(const first[], const second[], count): returns 0 if equal, otherwise -1 or 1 by the first differing
+// cell as signed values
+amx::error block_compare(amx64* amx, amx64_loader* loader, void* user, cell argc, cell argv, cell& retval) {
+  UNREFERENCED_PARAMETER(user);
 
   retval = 0;
 
-  if (argc != 1)
-    return amx::error::invalid_operand;
-  const auto ppfn = amx->data_v2p(argv);
-  if (!ppfn)
-    return amx::error::access_violation;
-  const auto pfn = *ppfn;
+  cell args[3]{};
+  if (const auto err = block_args(amx, argc, argv, args); err != amx::error::success)
+    return err;
+  const auto [va, vb, count] = args;
+  if (count == 0)
+    return amx::error::success;
 
-  to_amx_callback_free((context*)user, pfn);
+  const auto order = [](cell a, cell b) -> cell {
+    return (scell)a < (scell)b ? (cell)-1 : (cell)1;
+  };
+
+  const auto a = translate_range(loader, va, (size_t)count);
+  const auto b = translate_range(loader, vb, (size_t)count);
+  if (a && b) {
+    // equal blocks are the common case, let memcmp find whether there's a difference at all
+    if (memcmp(a, b, (size_t)count * sizeof(cell)) == 0)
+      return amx::error::success;
+    const auto mismatch = std::mismatch(a, a + count, b);
+    retval = order(*mismatch.first, *mismatch.second);
+    return amx::error::success;
+  }
 
+  for (cell i = 0; i < count; ++i) {
+    const auto pa = amx->mem.data().translate(va + i * sizeof(cell));
+    const auto pb = amx->mem.data().translate(vb + i * sizeof(cell));
+    if (!pa || !pb)
+      return amx::error::access_violation;
+    if (*pa != *pb) {
+      retval = order(*pa, *pb);
+      return amx::error::success;
+    }
+  }
   return amx::error::success;
 }
 
-const static amx64_loader::native_arg NATIVES[] =
-{
-  {"debug_print", &debug_print},
-  {"get_proc_address", &get_proc_address_wrap},
-  {"get_public", &get_public},
-  {"callback_alloc", &to_amx_callback_alloc_wrap},
-  {"callback_free", &to_amx_callback_free_wrap},
+// Array math natives, for reducing samples without an interpreted loop. Each array is translated once as a whole, so
+// one crossing from a mapping into another is an access violation. The loops are kept trivial so they vectorize.
+// Arithmetic is on signed cells and wraps on overflow, like the VM's own.
 
-#define DEFINE_NATIVE(name) { #name, &native_callback_wrapper<&name> }
+static amx::error array_range(amx64_loader* loader, cell vaddr, cell count, scell*& p) {
+  if (count == 0 || count > (cell)~(cell)0 / sizeof(cell))
+    return amx::error::invalid_operand;
+  p = (scell*)translate_range(loader, vaddr, (size_t)count);
+  return p ? amx::error::success : amx::error::access_violation;
+}
 
-  DEFINE_NATIVE(get_arch),
+// array_sum(const values[], count)
+amx::error array_sum(amx64* amx, amx64_loader* loader, void* user, cell argc, cell argv, cell& retval) {
+  UNREFERENCED_PARAMETER(user);
 
-  DEFINE_NATIVE(cpu_count),
-  DEFINE_NATIVE(cpu_set_affinity),
-  DEFINE_NATIVE(cpu_restore_affinity),
+  retval = 0;
 
-  DEFINE_NATIVE(msr_read),
-  DEFINE_NATIVE(msr_write),
+  cell args[2]{};
+  if (const auto err = native_args(amx, argc, argv, args); err != amx::error::success)
+    return err;
+  scell* values{};
+  if (const auto err = array_range(loader, args[0], args[1], values); err != amx::error::success)
+    return err;
 
-  DEFINE_NATIVE(interrupts_disable),
-  DEFINE_NATIVE(interrupts_enable),
+  cell sum{};
+  for (size_t i = 0; i < (size_t)args[1]; ++i)
+    sum += (cell)values[i];
+  retval = sum;
+  return amx::error::success;
+}
 
-  DEFINE_NATIVE(physical_read_byte),
-  DEFINE_NATIVE(physical_read_word),
-  DEFINE_NATIVE(physical_read_dword),
-  DEFINE_NATIVE(physical_read_qword),
+// array_mean(const values[], count): rounds towards zero
+amx::error array_mean(amx64* amx, amx64_loader* loader, void* user, cell argc, cell argv, cell& retval) {
+  if (const auto err = array_sum(amx, loader, user, argc, argv, retval); err != amx::error::success)
+    return err;
+  const auto pcount = amx->data_v2p(argv + sizeof(cell));
+  retval = (cell)((scell)retval / (scell)*pcount);
+  return amx::error::success;
+}
+
+// array_min(const values[], count)
+amx::error array_min(amx64* amx, amx64_loader* loader, void* user, cell argc, cell argv, cell& retval) {
+  UNREFERENCED_PARAMETER(user);
+
+  retval = 0;
+
+  cell args[2]{};
+  if (const auto err = native_args(amx, argc, argv, args); err != amx::error::success)
+    return err;
+  scell* values{};
+  if (const auto err = array_range(loader, args[0], args[1], values); err != amx::error::success)
+    return err;
+
+  auto result = values[0];
+  for (size_t i = 1; i < (size_t)args[1]; ++i)
+    result = values[i] < result ? values[i] : result;
+  retval = (cell)result;
+  return amx::error::success;
+}
+
+// array_max(const values[], count)
+amx::error array_max(amx64* amx, amx64_loader* loader, void* user, cell argc, cell argv, cell& retval) {
+  UNREFERENCED_PARAMETER(user);
+
+  retval = 0;
+
+  cell args[2]{};
+  if (const auto err = native_args(amx, argc, argv, args); err != amx::error::success)
+    return err;
+  scell* values{};
+  if (const auto err = array_range(loader, args[0], args[1], values); err != amx::error::success)
+    return err;
+
+  auto result = values[0];
+  for (size_t i = 1; i < (size_t)args[1]; ++i)
+    result = values[i] > result ? values[i] : result;
+  retval = (cell)result;
+  return amx::error::success;
+}
+
+// array_scale(values[], count, multiplier, divisor, offset): values[i] = values[i] * multiplier / divisor + offset, for
+// converting raw readings into units
+amx::error array_scale(amx64* amx, amx64_loader* loader, void* user, cell argc, cell argv, cell& retval) {
+  UNREFERENCED_PARAMETER(user);
+
+  retval = 0;
+
+  cell args[5]{};
+  if (const auto err = native_args(amx, argc, argv, args); err != amx::error::success)
+    return err;
+  scell* values{};
+  if (const auto err = array_range(loader, args[0], args[1], values); err != amx::error::success)
+    return err;
+  const auto mul = (scell)args[2];
+  const auto div = (scell)args[3];
+  const auto add = (scell)args[4];
+  if (div == 0)
+    return amx::error::invalid_operand;
+
+  for (size_t i = 0; i < (size_t)args[1]; ++i) {
+    const auto product = (scell)((cell)values[i] * (cell)mul);
+    // dividing the minimum by -1 faults the processor, negating wraps instead
+    const auto quotient = div == -1 ? (scell)(0 - (cell)product) : product / div;
+    values[i] = (scell)((cell)quotient + (cell)add);
+  }
+  return amx::error::success;
+}
+
+// array_delta(values[], previous[], count): replaces each value with how much it grew since previous, which is
+// updated to the current value. counters that wrapped around still give the right difference.
+amx::error array_delta(amx64* amx, amx64_loader* loader, void* user, cell argc, cell argv, cell& retval) {
+  UNREFERENCED_PARAMETER(user);
+
+  retval = 0;
+
+  cell args[3]{};
+  if (const auto err = native_args(amx, argc, argv, args); err != amx::error::success)
+    return err;
+  scell* values{};
+  if (const auto err = array_range(loader, args[0], args[2], values); err != amx::error::success)
+    return err;
+  scell* previous{};
+  if (const auto err = array_range(loader, args[1], args[2], previous); err != amx::error::success)
+    return err;
+
+  for (size_t i = 0; i < (size_t)args[2]; ++i) {
+    const auto current = values[i];
+    values[i] = (scell)((cell)current - (cell)previous[i]);
+    previous[i] = current;
+  }
+  return amx::error::success;
+}
+
+// array_clamp(values[], count, low, high): saturates each value into [low, high]
+amx::error array_clamp(amx64* amx, amx64_loader* loader, void* user, cell argc, cell argv, cell& retval) {
+  UNREFERENCED_PARAMETER(user);
+
+  retval = 0;
+
+  cell args[4]{};
+  if (const auto err = native_args(amx, argc, argv, args); err != amx::error::success)
+    return err;
+  scell* values{};
+  if (const auto err = array_range(loader, args[0], args[1], values); err != amx::error::success)
+    return err;
+  const auto low = (scell)args[2];
+  const auto high = (scell)args[3];
+  if (low > high)
+    return amx::error::invalid_operand;
+
+  for (size_t i = 0; i < (size_t)args[1]; ++i) {
+    const auto v = values[i];
+    values[i] = v < low ? low : v > high ? high : v;
+  }
+  return amx::error::success;
+}
+
+// Packed natives, for the byte buffers of _bytes publics: offsets are in bytes from the start of the array, values are
+// little endian and zero extended. The cells spanned by the value are translated together, so it can't straddle two
+// mappings.
+
+template <typename T>
+static amx::error packed_range(amx64_loader* loader, cell vbuf, cell offset, uint8_t*& p) {
+  if (offset > (cell)~(cell)0 - sizeof(T))
+    return amx::error::access_violation;
+  const auto first = offset / sizeof(cell);
+  const auto last = (offset + sizeof(T) - 1) / sizeof(cell);
+  const auto base = translate_range(loader, vbuf + (cell)(first * sizeof(cell)), (size_t)(last - first + 1));
+  if (!base)
+    return amx::error::access_violation;
+  p = (uint8_t*)base + offset % sizeof(cell);
+  return amx::error::success;
+}
+
+// packed_read_*(const buf[], offset)
+template <typename T>
+static amx::error packed_read(amx64* amx, amx64_loader* loader, void* user, cell argc, cell argv, cell& retval) {
+  UNREFERENCED_PARAMETER(user);
+
+  retval = 0;
+
+  cell args[2]{};
+  if (const auto err = native_args(amx, argc, argv, args); err != amx::error::success)
+    return err;
+  uint8_t* p{};
+  if (const auto err = packed_range<T>(loader, args[0], args[1], p); err != amx::error::success)
+    return err;
+
+  T value{};
+  memcpy(&value, p, sizeof(T));
+  retval = (cell)value;
+  return amx::error::success;
+}
+
+// packed_write_*(buf[], offset, value): only the low bytes of value are stored
+template <typename T>
+static amx::error packed_write(amx64* amx, amx64_loader* loader, void* user, cell argc, cell argv, cell& retval) {
+  UNREFERENCED_PARAMETER(user);
+
+  retval = 0;
+
+  cell args[3]{};
+  if (const auto err = native_args(amx, argc, argv, args); err != amx::error::success)
+    return err;
+  uint8_t* p{};
+  if (const auto err = packed_range<T>(loader, args[0], args[1], p); err != amx::error::success)
+    return err;
+
+  const auto value = (T)args[2];
+  memcpy(p, &value, sizeof(T));
+  return amx::error::success;
+}
+
+class wrapped_fast_mutex {
+  FAST_MUTEX _mutex{};
+
+public:
+  FORCEINLINE void init() { return ExInitializeFastMutex(&_mutex); }
+
+  FORCEINLINE void lock() { ExAcquireFastMutex(&_mutex); }
+  FORCEINLINE bool try_lock() { return TRUE == ExTryToAcquireFastMutex(&_mutex); }
+  FORCEINLINE void unlock() { ExReleaseFastMutex(&_mutex); }
+};
+
+// must be a power of two
+constexpr static size_t k_profile_hot_slots = 4096;
+constexpr static size_t k_profile_hot_probes = 8;
+
+struct vm_profile {
+  uint64_t total_instructions;
+  uint64_t dropped_hot_samples;
+  uint64_t opcodes[k_profile_opcode_count];
+  pio_profile_hot hot[k_profile_hot_slots];
+  // index of the public the current call entered through, or publics_count for callbacks
+  size_t current_public;
+  size_t publics_count;
+  pio_profile_public* publics;
+};
+
+constexpr static size_t k_sampler_ring_size = 1024;
+
+struct vm_sampler {
+  KTIMER timer;
+  KDPC dpc;
+  KSPIN_LOCK lock;
+  struct context* ctx;
+  uint64_t written;
+  uint64_t read;
+  uint64_t dropped;
+  pio_sample ring[k_sampler_ring_size];
+};
+
+// shared with user mode, see IOCTL_PIO_RING_REGISTER. everything behind header, sq, cq and data can change under us
+// at any time, so each submission is copied out once before it's looked at.
+struct vm_ring {
+  struct context* ctx;
+  PMDL mdl;
+  pio_ring_header* header;
+  pio_ring_submission* sq;
+  pio_ring_completion* cq;
+  uint8_t* data;
+  size_t data_size;
+  ULONG sq_entries;
+  ULONG cq_entries;
+  // the authoritative positions, the shared copies are only ever written
+  ULONG sq_head;
+  ULONG cq_tail;
+  // completions posted or still running, see vm_ring_drain
+  ULONG cq_reserved;
+  wrapped_fast_mutex mutex;
+  // polling mode only
+  PETHREAD thread;
+  KEVENT stop;
+  ULONG poll_interval_ms;
+  // the process whose pages are locked, see vm_ring_detach
+  HANDLE process_id;
+  LIST_ENTRY link;
+};
+
+// every registered ring, so that the pages of an exiting process can be unlocked wherever its handles ended up
+static LIST_ENTRY s_rings;
+static wrapped_fast_mutex s_rings_mutex;
+
+static void vm_ring_free(vm_ring* ring);
+
+constexpr static size_t k_jobs_ring_size = 256;
+
+struct vm_job {
+  bool active;
+  ULONG64 id;
+  ULONG period_ms;
+  // interrupt time
+  ULONG64 next_due;
+  ULONG in_count;
+  ULONG out_count;
+  cell in[k_job_max_cells];
+};
+
+// Periodic jobs of one handle, see IOCTL_PIO_JOB_REGISTER. They all run on one thread that sleeps on a coalescable
+// timer until the next job is due; jobs that come due within the timer's tolerance of each other run in one wakeup.
+struct vm_jobs {
+  struct context* ctx;
+  PETHREAD thread;
+  KTIMER timer;
+  KEVENT stop;
+  // set when the jobs change, so that the thread picks a new due time
+  KEVENT changed;
+  // the client's, signalled after every wakeup that produced results
+  PKEVENT event;
+  // protects everything below
+  wrapped_fast_mutex mutex;
+  vm_job jobs[k_job_max_jobs];
+  uint64_t written;
+  uint64_t read;
+  uint64_t dropped;
+  pio_job_record ring[k_jobs_ring_size];
+};
+
+static void vm_jobs_free(vm_jobs* jobs);
+
+// a pooled module is backed by at most this many instances, counting the primary
+constexpr static size_t k_max_pool_size = 64;
+
+// calls with buffers no bigger than this are copied through windows that stay mapped, instead of mapping the buffers
+constexpr static size_t k_io_window_cells = 256;
+constexpr static cell k_out_size_unset = ~(cell)0;
+
+struct context {
+  std::aligned_storage_t<sizeof(amx64_loader), alignof(amx64_loader)> loader_storage;
+  amx64_loader* loader;
+  const uint8_t* original_buf;
+  size_t original_buf_size;
+  wrapped_fast_mutex mutex;
+  uint64_t instruction_budget;
+  uint64_t instructions_left;
+  bool budget_exceeded;
+  // only client calls are budgeted, see vm_call
+  bool budget_active;
+  // IOCTL_PIO_MEMORY_TRACKING, keeps the single step hook installed so every instruction is sampled
+  volatile bool track_memory;
+  vm_profile* profile;
+  vm_sampler* sampler;
+  vm_ring* ring;
+  vm_jobs* jobs;
+  // only read by the sampler, which tolerates it being stale
+  volatile bool running;
+  // pooled modules only, see vm_pool_create. replicas have no buffer, profile or sampler of their own
+  context* replicas[k_max_pool_size - 1];
+  size_t replica_count;
+  // the NUMA node a replica's memory was allocated on
+  USHORT node;
+  // indices into the loader's publics of every ioctl_ public, an ID is an index into this
+  uint32_t* ioctl_publics;
+  size_t ioctl_publics_count;
+  // mapped for the lifetime of the instance, see vm_execute_locked
+  cell io_in_window_va;
+  cell io_out_window_va;
+  cell io_in_window[k_io_window_cells];
+  cell io_out_window[k_io_window_cells];
+
+  // output length the running ioctl_ public reported with set_output_size, k_out_size_unset if it didn't
+  cell out_size;
+
+  // debug_print, see vm_log_append. replicas share the primary's ID and record counter, and get its settings when
+  // picked for a call
+  uint64_t log_id;
+  volatile LONG64* log_counter;
+  volatile LONG64 log_appended;
+  // primary only, the module's record number the handle's next query expects, see vm_log_query. queries run
+  // under log_mutex, so that concurrent ones don't count the same gap twice
+  uint64_t log_expected;
+  wrapped_fast_mutex log_mutex;
+  volatile bool log_enabled;
+  volatile ULONG log_max_per_second;
+  uint64_t log_window_start;
+  ULONG log_window_count;
+  volatile LONG64 log_rate_limited;
+};
+
+static bool vm_map_io_windows(context* ctx) {
+  const auto loader = ctx->loader;
+  return loader->map_data(ctx->io_in_window, k_io_window_cells, ctx->io_in_window_va)
+    && loader->map_data(ctx->io_out_window, k_io_window_cells, ctx->io_out_window_va);
+}
+
+static void vm_profile_enter(vm_profile* profile, cell cip) {
+  size_t i;
+  for (i = 0; i < profile->publics_count; ++i)
+    if (profile->publics[i].cip == cip)
+      break;
+  profile->current_public = i;
+  if (i < profile->publics_count)
+    ++profile->publics[i].calls;
+}
+
+static void vm_profile_step(vm_profile* profile, amx64* amx) {
+  ++profile->total_instructions;
+
+  const auto cip = amx->CIP;
+  if (const auto pop = amx->mem.code().translate(amx->COD + cip))
+    ++profile->opcodes[*pop & (k_profile_opcode_count - 1)];
+
+  if (profile->current_public < profile->publics_count)
+    ++profile->publics[profile->current_public].instructions;
+
+  // code is laid out linearly, so the cell index itself spreads well enough
+  const auto base = (size_t)(cip / sizeof(cell));
+  for (size_t i = 0; i < k_profile_hot_probes; ++i) {
+    auto& slot = profile->hot[(base + i) & (k_profile_hot_slots - 1)];
+    if (slot.count == 0)
+      slot.cip = cip;
+    else if (slot.cip != cip)
+      continue;
+    ++slot.count;
+    return;
+  }
+  ++profile->dropped_hot_samples;
+}
+
+static amx::error vm_single_step(amx64* amx, amx64_loader* loader, void* user) {
+  UNREFERENCED_PARAMETER(loader);
+
+  const auto ctx = (context*)user;
+  if (const auto profile = ctx->profile)
+    vm_profile_step(profile, amx);
+  if (ctx->budget_active) {
+    if (ctx->instructions_left == 0) {
+      ctx->budget_exceeded = true;
+      return amx::error::invalid_operand;
+    }
+    --ctx->instructions_left;
+  }
+  return amx::error::success;
+}
+
+// all entries into the VM go through here, so per-call state is reset in one place
+static amx::error vm_call_budgeted(
+  context* ctx,
+  uint64_t budget,
+  cell cip,
+  cell& ret,
+  std::initializer_list<cell> args
+) {
+  ctx->instructions_left = budget;
+  ctx->budget_active = budget != 0;
+  ctx->budget_exceeded = false;
+  if (const auto profile = ctx->profile)
+    vm_profile_enter(profile, cip);
+  ctx->running = true;
+  const auto err = ctx->loader->amx.call(cip, ret, args);
+  ctx->running = false;
+  return err;
+}
+
+// main, unload and callbacks run unbudgeted: a callback that fails takes the system down with it, and an unload cut
+// short would leave callbacks behind that point at a freed context
+static amx::error vm_call(context* ctx, cell cip, cell& ret, std::initializer_list<cell> args = {}) {
+  return vm_call_budgeted(ctx, 0, cip, ret, args);
+}
+
+// ioctl_* publics all take (in, in_count, out, out_count). these are the client calls the budget is for
+FORCEINLINE static amx::error vm_call_ioctl(context* ctx, cell cip, cell& ret, cell in_va, cell in_count, cell out_va, cell out_count) {
+  const auto DAT = ctx->loader->amx.DAT;
+  return vm_call_budgeted(ctx, ctx->instruction_budget, cip, ret, {in_va - DAT, in_count, out_va - DAT, out_count});
+}
+
+static NTSTATUS vm_call_error_status(context* ctx) {
+  return ctx->budget_exceeded ? STATUS_IO_TIMEOUT : STATUS_UNSUCCESSFUL;
+}
+
+// the hook costs an indirect call per instruction, so only install it while something needs it
+static void vm_update_single_step(context* ctx) {
+  const auto needed = ctx->instruction_budget != 0 || ctx->profile != nullptr || ctx->track_memory;
+  ctx->loader->set_on_single_step(needed ? &vm_single_step : nullptr);
+}
+
+struct to_amx_callback_context {
+  context* ctx;
+  cell cip;
+};
+
+constexpr static size_t k_to_amx_callback_count = 0x100;
+
+static to_amx_callback_context s_to_amx_callback_data[k_to_amx_callback_count];
+
+static __declspec(noinline) cell to_amx_callback_dispatch(size_t idx, cell args) {
+  const auto cb_ctx = &s_to_amx_callback_data[idx];
+  const auto vm_ctx = cb_ctx->ctx;
+  if (!vm_ctx)
+    __fastfail(FAST_FAIL_INVALID_JUMP_BUFFER);
+  std::unique_lock lock{vm_ctx->mutex};
+  const auto cip = cb_ctx->cip;
+  if (!cip)
+    __fastfail(FAST_FAIL_INVALID_JUMP_BUFFER);
+  cell ret{};
+  const auto status = vm_callback_precall(vm_ctx, cip);
+  if (!NT_SUCCESS(status))
+    __fastfail(FAST_FAIL_GUARD_ICALL_CHECK_FAILURE);
+  const auto res = vm_call(vm_ctx, cip, ret, {args});
+  if (res != amx::error::success)
+    __fastfail(FAST_FAIL_INVALID_THREAD_STATE);
+  return ret;
+}
+
+template <size_t Idx>
+static cell to_amx_callback(cell first_arg, ...) {
+  va_list va{};
+#ifdef ARCH_X86
+  // x86: use standard va_start with first parameter
+  va_start(va, first_arg);
+#else
+  __va_start(&va, 0); // msvc x64 hack
+#endif
+  const auto args = (cell)va;
+  const auto rv = to_amx_callback_dispatch(Idx, args);
+  return rv;
+}
+
+// Define a type for the callback function pointer
+using to_amx_callback_fn = decltype(&to_amx_callback<0>);
+
+// Helper template to generate the array with all indices
+template <size_t... Indices>
+static constexpr std::array<to_amx_callback_fn, sizeof...(Indices)> make_callback_array(std::index_sequence<Indices...>) {
+  return {&to_amx_callback<Indices>...};
+}
+
+// Generate the array with indices from 0 to k_to_amx_callback_count-1
+static constexpr auto k_to_amx_callback_fns = make_callback_array(std::make_index_sequence<k_to_amx_callback_count>{});
+
+static cell to_amx_callback_alloc(context* vm_ctx, cell cip) {
+  for (size_t i = 0; i < k_to_amx_callback_count; ++i) {
+    auto& cb_ctx = s_to_amx_callback_data[i];
+    if (cb_ctx.ctx == nullptr) {
+      if (nullptr == _InterlockedCompareExchangePointer((PVOID volatile*)&cb_ctx.ctx, vm_ctx, nullptr)) {
+        cb_ctx.cip = cip;
+        return (cell)k_to_amx_callback_fns[i];
+      }
+    }
+  }
+  return 0;
+}
+
+static void to_amx_callback_free(context* vm_ctx, cell pfn) {
+  size_t i;
+  for (i = 0; i < k_to_amx_callback_count; ++i)
+    if (pfn == (cell)k_to_amx_callback_fns[i])
+      break;
+  if (i == k_to_amx_callback_count)
+    __fastfail(FAST_FAIL_ASAN_ERROR);
+  auto& cb_ctx = s_to_amx_callback_data[i];
+  if (cb_ctx.ctx != vm_ctx)
+    __fastfail(FAST_FAIL_ASAN_ERROR);
+  cb_ctx.cip = 0;
+  cb_ctx.ctx = nullptr;
+}
+
+static amx::error to_amx_callback_alloc_wrap(amx64* amx, amx64_loader* loader, void* user, cell argc, cell argv, cell& retval) {
+  UNREFERENCED_PARAMETER(loader);
+
+  if (argc != 1)
+    return amx::error::invalid_operand;
+  const auto pcip = amx->data_v2p(argv);
+  if (!pcip)
+    return amx::error::access_violation;
+  const auto cip = *pcip;
+
+  retval = to_amx_callback_alloc((context*)user, cip);
+
+  return amx::error::success;
+}
+
+static amx::error to_amx_callback_free_wrap(amx64* amx, amx64_loader* loader, void* user, cell argc, cell argv, cell& retval) {
+  UNREFERENCED_PARAMETER(loader);
+
+  retval = 0;
+
+  if (argc != 1)
+    return amx::error::invalid_operand;
+  const auto ppfn = amx->data_v2p(argv);
+  if (!ppfn)
+    return amx::error::access_violation;
+  const auto pfn = *ppfn;
+
+  to_amx_callback_free((context*)user, pfn);
+
+  return amx::error::success;
+}
+
+// set_output_size(size): how much of the output buffer the current ioctl_ public filled, in cells or for _bytes
+// publics in bytes. only that much is returned to the caller, sizes past the end of the buffer are clamped.
+static amx::error set_output_size(amx64* amx, amx64_loader* loader, void* user, cell argc, cell argv, cell& retval) {
+  UNREFERENCED_PARAMETER(loader);
+
+  retval = 0;
+
+  cell args[1]{};
+  if (const auto err = native_args(amx, argc, argv, args); err != amx::error::success)
+    return err;
+
+  ((context*)user)->out_size = args[0] == k_out_size_unset ? k_out_size_unset - 1 : args[0];
+  return amx::error::success;
+}
+
+// With logging enabled, debug_print doesn't format anything: it stores the format's address and the argument values
+// in a driver wide ring, and the text is only made when the module's handle reads its records with
+// IOCTL_PIO_LOG_QUERY. A writer claims its slot by marking it busy and publishes it by storing the sequence number; if
+// another writer still has the slot from a lap ago, the record is dropped rather than waited for.
+
+// must be a power of two
+constexpr static size_t k_log_entries = 1024;
+constexpr static size_t k_log_max_args = 8;
+constexpr static LONG64 k_log_busy = -1;
+// formats are read back long after the call, so only ones in the module's own data are kept
+constexpr static cell k_log_format_dynamic = ~(cell)0;
+
+struct vm_log_record {
+  // sequence number of the record, k_log_busy while it's written, 0 if never used
+  volatile LONG64 stamp;
+  uint64_t vm_id;
+  // numbers the module's own records, gaps are records it lost
+  uint64_t vm_sequence;
+  uint64_t timestamp;
+  cell format;
+  size_t arg_count;
+  // the format takes more arguments than fit
+  bool args_truncated;
+  cell args[k_log_max_args];
+};
+
+static vm_log_record s_log[k_log_entries];
+static volatile LONG64 s_log_sequence;
+static volatile LONG64 s_log_vm_ids;
+
+// per instance, so a pooled module gets up to max_per_second for each of its instances
+static bool vm_log_admit(context* ctx) {
+  const auto max = ctx->log_max_per_second;
+  if (max == 0)
+    return true;
+  const auto now = KeQueryInterruptTime();
+  if (now - ctx->log_window_start >= 10000000) {
+    ctx->log_window_start = now;
+    ctx->log_window_count = 0;
+  }
+  if (ctx->log_window_count >= max) {
+    _InterlockedIncrement64(&ctx->log_rate_limited);
+    return false;
+  }
+  ++ctx->log_window_count;
+  return true;
+}
+
+static void vm_log_append(context* ctx, cell format, const cell* args, size_t arg_count, bool args_truncated) {
+  const auto vm_sequence = (uint64_t)_InterlockedIncrement64(ctx->log_counter);
+  const auto sequence = _InterlockedIncrement64(&s_log_sequence);
+  auto& record = s_log[(size_t)sequence & (k_log_entries - 1)];
+  const auto old = record.stamp;
+  if (old == k_log_busy || _InterlockedCompareExchange64(&record.stamp, k_log_busy, old) != old)
+    return;
+  record.vm_id = ctx->log_id;
+  record.vm_sequence = vm_sequence;
+  record.timestamp = KeQueryInterruptTime();
+  record.format = format;
+  record.arg_count = arg_count;
+  record.args_truncated = args_truncated;
+  memcpy(record.args, args, arg_count * sizeof(cell));
+  _InterlockedExchange64(&record.stamp, sequence);
+}
+
+// debug_print(const format[], ...): arguments are by reference, as with any variadic native. the format and
+// arguments are checked up front either way, so what the module sees doesn't depend on whether anyone is logging. goes
+// to the kernel debugger as it's printed, or to the log ring once the handle enabled it; the ring keeps only the first
+// k_log_max_args arguments
+amx::error debug_print(amx64* amx, amx64_loader* loader, void* user, cell argc, cell argv, cell& retval) {
+  retval = 0;
+
+  if (argc == 0)
+    return amx::error::invalid_operand;
+  char message[1024];
+  cell args[64]{};
+  const auto pvfmt = amx->data_v2p(argv);
+  if (!pvfmt)
+    return amx::error::access_violation;
+  const auto vfmt = *pvfmt;
+  // the output is never shorter than the format, so the format is never read past the message size
+  char fmt[std::size(message)];
+  if (amx_strcpy(fmt, std::size(fmt), loader, vfmt) == -1)
+    return amx::error::access_violation;
+  size_t arg_count{};
+  if (!debug_print_format(message, fmt, arg_count))
+    return amx::error::invalid_operand;
+
+  if (arg_count > (size_t)argc - 1)
+    return amx::error::invalid_operand;
+
+  if (arg_count > std::size(args))
+    return amx::error::invalid_operand;
+
+  for (size_t i = 0; i < arg_count; ++i) {
+    const auto pparg = amx->data_v2p(argv + (i + 1) * sizeof(cell));
+    if (!pparg)
+      return amx::error::invalid_operand;
+    const auto parg = amx->mem.data().translate(*pparg);
+    if (!parg)
+      return amx::error::invalid_operand;
+    args[i] = *parg;
+  }
+
+  const auto ctx = (context*)user;
+  if (!ctx->log_enabled) {
+    vDbgPrintExWithPrefix("[PawnIO] debug_print: ", DPFLTR_DEFAULT_ID, 3, message, (va_list)args);
+    return amx::error::success;
+  }
+
+  if (!vm_log_admit(ctx))
+    return amx::error::success;
+  const auto kept = std::min(arg_count, k_log_max_args);
+  const auto is_static = (size_t)vfmt < loader->get_heap_base_count() * sizeof(cell);
+  vm_log_append(ctx, is_static ? vfmt : k_log_format_dynamic, args, kept, arg_count > kept);
+  return amx::error::success;
+}
+
+const static amx64_loader::native_arg NATIVES[] =
+{
+  {"debug_print", &debug_print},
+  {"get_proc_address", &get_proc_address_wrap},
+  {"get_public", &get_public},
+  {"get_public_name", &get_public_name},
+  {"callback_alloc", &to_amx_callback_alloc_wrap},
+  {"callback_free", &to_amx_callback_free_wrap},
+  {"set_output_size", &set_output_size},
+  {"block_copy", &block_copy},
+  {"block_fill", &block_fill},
+  {"block_compare", &block_compare},
+  {"array_sum", &array_sum},
+  {"array_mean", &array_mean},
+  {"array_min", &array_min},
+  {"array_max", &array_max},
+  {"array_scale", &array_scale},
+  {"array_delta", &array_delta},
+  {"array_clamp", &array_clamp},
+  {"packed_read_byte", &packed_read<uint8_t>},
+  {"packed_read_word", &packed_read<uint16_t>},
+  {"packed_read_dword", &packed_read<uint32_t>},
+  {"packed_write_byte", &packed_write<uint8_t>},
+  {"packed_write_word", &packed_write<uint16_t>},
+  {"packed_write_dword", &packed_write<uint32_t>},
+
+#define DEFINE_NATIVE(name) { #name, &native_callback_wrapper<&name> }
+
+  DEFINE_NATIVE(get_arch),
+
+  DEFINE_NATIVE(cpu_count),
+  DEFINE_NATIVE(cpu_set_affinity),
+  DEFINE_NATIVE(cpu_restore_affinity),
+
+  DEFINE_NATIVE(msr_read),
+  DEFINE_NATIVE(msr_write),
+
+  DEFINE_NATIVE(interrupts_disable),
+  DEFINE_NATIVE(interrupts_enable),
+
+  DEFINE_NATIVE(physical_read_byte),
+  DEFINE_NATIVE(physical_read_word),
+  DEFINE_NATIVE(physical_read_dword),
+  DEFINE_NATIVE(physical_read_qword),
 
   DEFINE_NATIVE(physical_write_byte),
   DEFINE_NATIVE(physical_write_word),
   DEFINE_NATIVE(physical_write_dword),
   DEFINE_NATIVE(physical_write_qword),
 
-  DEFINE_NATIVE(io_space_map),
-  DEFINE_NATIVE(io_space_unmap),
+  DEFINE_NATIVE(io_space_map),
+  DEFINE_NATIVE(io_space_unmap),
+
+  DEFINE_NATIVE(virtual_read_byte),
+  DEFINE_NATIVE(virtual_read_word),
+  DEFINE_NATIVE(virtual_read_dword),
+  DEFINE_NATIVE(virtual_read_qword),
+
+  DEFINE_NATIVE(virtual_write_byte),
+  DEFINE_NATIVE(virtual_write_word),
+  DEFINE_NATIVE(virtual_write_dword),
+  DEFINE_NATIVE(virtual_write_qword),
+
+  DEFINE_NATIVE(virtual_cmpxchg_byte2),
+  DEFINE_NATIVE(virtual_cmpxchg_word2),
+  DEFINE_NATIVE(virtual_cmpxchg_dword2),
+  DEFINE_NATIVE(virtual_cmpxchg_qword2),
+
+  DEFINE_NATIVE(virtual_alloc),
+  DEFINE_NATIVE(virtual_free),
+
+  DEFINE_NATIVE(pci_config_read_byte),
+  DEFINE_NATIVE(pci_config_read_word),
+  DEFINE_NATIVE(pci_config_read_dword),
+  DEFINE_NATIVE(pci_config_read_qword),
+
+  DEFINE_NATIVE(pci_config_write_byte),
+  DEFINE_NATIVE(pci_config_write_word),
+  DEFINE_NATIVE(pci_config_write_dword),
+  DEFINE_NATIVE(pci_config_write_qword),
+
+  DEFINE_NATIVE(invoke),
+
+  DEFINE_NATIVE(microsleep),
+  DEFINE_NATIVE(microsleep2),
+
+  DEFINE_NATIVE(qpc),
+
+#if defined(ARCH_A64)
+
+#elif defined(ARCH_X64)
+
+  DEFINE_NATIVE(query_dell_smm),
+
+  DEFINE_NATIVE(io_out_byte),
+  DEFINE_NATIVE(io_out_word),
+  DEFINE_NATIVE(io_out_dword),
+
+  DEFINE_NATIVE(io_in_byte),
+  DEFINE_NATIVE(io_in_word),
+  DEFINE_NATIVE(io_in_dword),
+
+  DEFINE_NATIVE(llwpcb),
+  DEFINE_NATIVE(slwpcb),
+
+  DEFINE_NATIVE(cpuid),
+
+  DEFINE_NATIVE(cr_read),
+  DEFINE_NATIVE(cr_write),
+
+  DEFINE_NATIVE(dr_read),
+  DEFINE_NATIVE(dr_write),
+
+  DEFINE_NATIVE(xcr_read),
+  DEFINE_NATIVE(xcr_write),
+
+  DEFINE_NATIVE(invlpg),
+  DEFINE_NATIVE(invpcid),
+
+  DEFINE_NATIVE(readpmc),
+
+  DEFINE_NATIVE(rdtsc),
+  DEFINE_NATIVE(rdtscp),
+
+  DEFINE_NATIVE(rdrand),
+  DEFINE_NATIVE(rdseed),
+
+  DEFINE_NATIVE(lidt),
+  DEFINE_NATIVE(sidt),
+
+  DEFINE_NATIVE(lgdt),
+  DEFINE_NATIVE(sgdt),
+
+  DEFINE_NATIVE(mxcsr_read),
+  DEFINE_NATIVE(mxcsr_write),
+
+  DEFINE_NATIVE(stac),
+  DEFINE_NATIVE(clac),
+
+  DEFINE_NATIVE(halt),
+
+  DEFINE_NATIVE(ud2),
+
+  DEFINE_NATIVE(int3),
+
+  DEFINE_NATIVE(int2c),
+
+  DEFINE_NATIVE(wbinvd),
+
+#endif
+
+#undef DEFINE_NATIVE
+};
+
+void __CRTDECL operator delete(void*, size_t) noexcept {
+  __debugbreak();
+}
+
+constexpr static uint8_t k_pubkey_namazso_2023[] = {0x52, 0x53, 0x41, 0x31, 0x00, 0x10, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x01, 0xB5, 0x45, 0xB8, 0x15, 0xF0, 0x2A, 0xEB, 0xCA, 0xC9, 0x35, 0x8F, 0x54, 0x15, 0x83, 0x12, 0x2C, 0xC3, 0xF3, 0x5E, 0x1E, 0xE7, 0xFB, 0xD3, 0xE1, 0x68, 0x73, 0x3B, 0x36, 0xC0, 0x5C, 0x6F, 0xD3, 0xBA, 0xF4, 0xD0, 0xA9, 0x9B, 0x6E, 0x9C, 0x66, 0x43, 0x2F, 0xC9, 0xB2, 0x82, 0xDF, 0x24, 0x6D, 0x8F, 0x5F, 0x45, 0xAF, 0x02, 0xDD, 0x6A, 0xEF, 0x04, 0x01, 0x74, 0x69, 0xC3, 0x20, 0x70, 0xDB, 0x3F, 0x05, 0x97, 0x9E, 0xE6, 0x01, 0x6B, 0x9E, 0x28, 0x53, 0x03, 0x59, 0x02, 0x98, 0x4C, 0x41, 0xAB, 0xB2, 0x56, 0x5F, 0xD6, 0x24, 0x98, 0xD1, 0xB3, 0xF9, 0xF8, 0x46, 0xC7, 0x21, 0x4B, 0xDF, 0xFD, 0xF2, 0x88, 0x2A, 0xCE, 0xDC, 0x75, 0x36, 0x40, 0xC2, 0x5E, 0x0B, 0x26, 0x17, 0x7A, 0x3D, 0xD6, 0x34, 0xD7, 0x47, 0xD6, 0x61, 0xE1, 0x33, 0xD7, 0x7A, 0x00, 0x7E, 0x9F, 0xEB, 0x92, 0x33, 0x52, 0x65, 0x8E, 0xF8, 0x7C, 0x49, 0xD4, 0x22, 0xB8, 0x22, 0xBD, 0x59, 0x56, 0xBC, 0xD5, 0x1B, 0x64, 0x4C, 0x91, 0x50, 0xAB, 0x1F, 0x67, 0x9F, 0x84, 0xDD, 0x8B, 0x4F, 0xFC, 0x28, 0x26, 0x52, 0x36, 0x49, 0x67, 0x0D, 0x6C, 0xA4, 0xA1, 0xAA, 0xEC, 0x2B, 0xB0, 0x05, 0x09, 0x08, 0x20, 0x38, 0x82, 0xAE, 0x47, 0xB9, 0x3C, 0xAE, 0x50, 0xBF, 0x93, 0x69, 0x94, 0xB5, 0x98, 0x7C, 0xA8, 0x2E, 0xA9, 0x8E, 0x7B, 0xC2, 0xB2, 0x12, 0xB9, 0xB1, 0x62, 0x46, 0x3C, 0xED, 0x24, 0x9C, 0x89, 0xE0, 0xB8, 0x46, 0x26, 0x1A, 0x5A, 0x08, 0xD6, 0xF0, 0x2A, 0xA3, 0x28, 0xB6, 0x73, 0x60, 0xAE, 0xC3, 0x2D, 0x4C, 0x5A, 0x24, 0xF1, 0x58, 0x4C, 0x51, 0xD2, 0x66, 0xE9, 0xD9, 0x61, 0x98, 0x4D, 0xDE, 0x94, 0xD8, 0x44, 0x1F, 0x62, 0xF6, 0x4E, 0xF9, 0x73, 0x44, 0xA4, 0x7A, 0x2C, 0x2D, 0xC1, 0xDB, 0x4F, 0x58, 0xD6, 0x70, 0xB2, 0x6E, 0xE8, 0xD9, 0x50, 0x01, 0x35, 0x4F, 0x39, 0x49, 0x2E, 0x09, 0x76, 0x47, 0x9C, 0x3C, 0x7E, 0x72, 0x33, 0xCA, 0x13, 0xD7, 0x29, 0x82, 0xFB, 0x14, 0xAD, 0x4E, 0xC3, 0xA6, 0xC6, 0x4C, 0x18, 0x84, 0xB5, 0x83, 0x7A, 0xF0, 0x99, 0xBA, 0x1D, 0x56, 0xD2, 0xA2, 0xDF, 0x14, 0x34, 0x01, 0x6F, 0x83, 0x8D, 0xB8, 0xA0, 0x16, 0x2C, 0x36, 0x90, 0x0F, 0x96, 0x2D, 0x3B, 0x80, 0x58, 0x5C, 0xE7, 0x9D, 0x0D, 0x73, 0x38, 0xCA, 0xEE, 0x43, 0xF7, 0xC0, 0x37, 0xA4, 0xEA, 0xDD, 0x76, 0xCC, 0xA2, 0xF3, 0x54, 0xC8, 0x45, 0xC9, 0xBE, 0x3F, 0xCE, 0xAA, 0x98, 0x2F, 0x4C, 0x97, 0x87, 0x56, 0x00, 0x81, 0x6A, 0x7A, 0x41, 0x52, 0xF7, 0xF9, 0x0D, 0xEE, 0x5D, 0xB6, 0x05, 0x1F, 0x40, 0x9F, 0xDE, 0x75, 0x97, 0xD5, 0x8F, 0x28, 0x04, 0xDA, 0x57, 0xA2, 0x76, 0x52, 0x49, 0x35, 0xAC, 0x54, 0xF3, 0x09, 0xA6, 0x68, 0xEC, 0x84, 0xB8, 0x87, 0xD9, 0xBE, 0x26, 0xED, 0xFD, 0x75, 0x7D, 0x2A, 0x1B, 0x55, 0x18, 0x31, 0xA7, 0xA0, 0x44, 0xC5, 0x4A, 0x05, 0xD2, 0x55, 0x44, 0x70, 0x1D, 0x35, 0xE4, 0x61, 0x03, 0x5D, 0x82, 0x3C, 0x48, 0x40, 0x5F, 0x58, 0x64, 0x4E, 0xFF, 0xA6, 0xA1, 0x24, 0x7A, 0xAC, 0xF0, 0xF8, 0x3F, 0x9E, 0x9B, 0xE0, 0x53, 0x04, 0x55, 0xB1, 0xED, 0xDC, 0xC0, 0xC9, 0x9E, 0x5E, 0x31, 0x46, 0x09, 0x83, 0x51, 0x41, 0xBD, 0x41, 0x73, 0xC0, 0xD8, 0x36, 0x23, 0xAE, 0x0B, 0xDF, 0x89, 0x67, 0x2A, 0xC7, 0x56, 0x36, 0xA8, 0xE2, 0x76, 0xB8, 0xCB, 0x75, 0xA1, 0xF0, 0x7C, 0xAC, 0x4D, 0xCD, 0x56, 0xBB, 0x6A, 0x03, 0xCA, 0x7A, 0x89, 0xD2, 0x06, 0xE9, 0x02, 0x48, 0x17, 0x2F, 0xCF, 0xBC, 0xC1, 0xB6, 0xF7, 0xBF, 0x8A, 0xC1, 0xA7, 0x9B};
+
+constexpr static trusted_pubkey k_trusted_keys[] = {
+  {k_pubkey_namazso_2023, sizeof(k_pubkey_namazso_2023)},
+  {}
+};
+
+const trusted_pubkey* pawnio_trusted_keys() {
+  return k_trusted_keys;
+}
+
+static NTSTATUS check_signature(const void* mem, size_t len, const uint8_t* sig, size_t sig_len) {
+  sha256_buf sha256;
+  auto status = calculate_sha256(mem, len, &sha256);
+  if (!NT_SUCCESS(status))
+    return status;
+
+  for (auto it = k_trusted_keys; it->pubkey_data; ++it) {
+    status = verify_sig(sha256, sig, sig_len, it->pubkey_data, it->pubkey_len);
+    if (NT_SUCCESS(status))
+      break;
+  }
+
+  return status;
+}
+
+// names that fit the 32 byte header of IOCTL_PIO_EXECUTE_FN, with the terminator
+constexpr static size_t k_max_ioctl_name = 32;
+
+static bool vm_is_ioctl_name(const char* name) {
+  return strncmp(name, "ioctl_", 6) == 0 && strlen(name) < k_max_ioctl_name;
+}
+
+// Resolves the ioctl_ publics once, so that calls by ID skip the name lookup. IDs follow the order of the public
+// table, which is sorted by name, so a given module always hands out the same ones.
+static NTSTATUS vm_build_ioctl_table(context* ctx) {
+  const auto loader = ctx->loader;
+  size_t count = 0;
+  for (size_t i = 0; i < loader->get_publics_count(); ++i)
+    if (vm_is_ioctl_name(loader->get_public_by_index(i).first))
+      ++count;
+  if (count == 0)
+    return STATUS_SUCCESS;
+
+  const auto table = (uint32_t*)ExAllocatePoolZero(NonPagedPoolNx, count * sizeof(uint32_t), 'iPwP');
+  if (!table)
+    return STATUS_NO_MEMORY;
+  size_t id = 0;
+  for (size_t i = 0; i < loader->get_publics_count(); ++i)
+    if (vm_is_ioctl_name(loader->get_public_by_index(i).first))
+      table[id++] = (uint32_t)i;
+
+  ctx->ioctl_publics = table;
+  ctx->ioctl_publics_count = count;
+  return STATUS_SUCCESS;
+}
+
+static NTSTATUS vm_load_binary_internal(context** ctx, PVOID buffer, SIZE_T size) {
+  *ctx = nullptr;
+
+  if (size < 4)
+    return STATUS_INVALID_PARAMETER;
+  const auto sig_len = *(PULONG)buffer;
+  if (sig_len > (size - 4))
+    return STATUS_INVALID_PARAMETER;
+
+  const auto mem = (uint8_t*)buffer + 4 + sig_len;
+  const auto len = size - 4 - sig_len;
+
+  auto status = check_signature(mem, len, (uint8_t*)buffer + 4, sig_len);
+
+#ifdef PAWNIO_UNRESTRICTED
+  DbgPrint("[PawnIO] Signature check result: %X\n", status);
+  status = STATUS_SUCCESS;
+#endif
+
+  if (NT_SUCCESS(status)) {
+    // extra copy
+    const auto copy = (uint8_t*)ExAllocatePoolZero(NonPagedPoolNxCacheAligned, size, 'cpmA');
+    if (!copy) {
+      status = STATUS_NO_MEMORY;
+    } else {
+      // load
+      const auto my_ctx = (context*)ExAllocatePoolZero(NonPagedPoolNxCacheAligned, sizeof(context), 'OIwP');
+      if (!my_ctx) {
+        status = STATUS_NO_MEMORY;
+      } else {
+        memcpy(copy, buffer, size);
+        my_ctx->original_buf = copy;
+        my_ctx->original_buf_size = size;
+        my_ctx->mutex.init();
+        my_ctx->log_id = (uint64_t)_InterlockedIncrement64(&s_log_vm_ids);
+        my_ctx->log_counter = &my_ctx->log_appended;
+        my_ctx->log_mutex.init();
+        // records are numbered from 1
+        my_ctx->log_expected = 1;
+        const auto loader = new(&my_ctx->loader_storage) amx64_loader();
+        my_ctx->loader = loader;
+
+        const amx64_loader::callbacks_arg callbacks
+        {
+          .natives = NATIVES,
+          .natives_count = std::size(NATIVES),
+          .on_single_step = nullptr,
+          .on_break = nullptr,
+          .user_data = my_ctx,
+          .retain_function_symbols = true
+        };
+
+        const auto result = loader->init(mem, len, callbacks);
+
+        if (result != amx::loader_error::success) {
+          status = STATUS_UNSUCCESSFUL;
+        } else {
+          status = vm_map_io_windows(my_ctx) ? vm_build_ioctl_table(my_ctx) : STATUS_UNSUCCESSFUL;
+          if (NT_SUCCESS(status)) {
+            *ctx = my_ctx;
+            return STATUS_SUCCESS;
+          }
+        }
+
+        loader->~amx64_loader();
+        ExFreePool(my_ctx);
+      }
+
+      ExFreePool(copy);
+    }
+  }
+  return status;
+}
+
+// Runs at DISPATCH_LEVEL on whatever CPU the timer fires on, concurrently with the VM. It only reads registers and the
+// loader's data slab, never the memory manager, since mappings may change under it. The slab stays valid until the
+// sampler is stopped. Stack contents may be mid-update, so the frame walk is bounds checked and only moves upwards.
+static void vm_sampler_dpc(PKDPC dpc, PVOID deferred_context, PVOID arg1, PVOID arg2) {
+  UNREFERENCED_PARAMETER(dpc);
+  UNREFERENCED_PARAMETER(arg1);
+  UNREFERENCED_PARAMETER(arg2);
+
+  const auto sampler = (vm_sampler*)deferred_context;
+  const auto ctx = sampler->ctx;
+  if (!ctx->running)
+    return;
+
+  const auto loader = ctx->loader;
+  const auto& amx = loader->amx;
+  const volatile cell* data = loader->get_data();
+  const auto data_count = loader->get_data_count();
+
+  pio_sample sample{};
+  sample.timestamp = KeQueryInterruptTime();
+  sample.cip = *(const volatile cell*)&amx.CIP;
+
+  // frame: [FRM] = caller's FRM, [FRM + cell] = return address. the slab is mapped at DAT, so FRM indexes it directly
+  auto frm = *(const volatile cell*)&amx.FRM;
+  while (sample.frame_count < k_sample_max_frames) {
+    const auto idx = (size_t)(frm / sizeof(cell));
+    if (frm % sizeof(cell) != 0 || idx + 1 >= data_count)
+      break;
+    const auto ret = data[idx + 1];
+    // call() pushes a zero return address for the outermost frame
+    if (ret == 0)
+      break;
+    sample.frames[sample.frame_count++] = ret;
+    const auto prev = data[idx];
+    if (prev <= frm)
+      break;
+    frm = prev;
+  }
+
+  KeAcquireSpinLockAtDpcLevel(&sampler->lock);
+  if (sampler->written - sampler->read == k_sampler_ring_size) {
+    ++sampler->read;
+    ++sampler->dropped;
+  }
+  sampler->ring[sampler->written % k_sampler_ring_size] = sample;
+  ++sampler->written;
+  KeReleaseSpinLockFromDpcLevel(&sampler->lock);
+}
+
+static void vm_sampler_stop(vm_sampler* sampler) {
+  KeCancelTimer(&sampler->timer);
+  KeFlushQueuedDpcs();
+  ExFreePool(sampler);
+}
+
+// ExAllocatePool3 is only there since Windows 10 2004, so it's looked up at runtime. Older systems just get memory
+// from wherever. Both return it zeroed.
+static PVOID vm_allocate_on_node(SIZE_T size, ULONG tag, USHORT node) {
+  UNICODE_STRING name = RTL_CONSTANT_STRING(L"ExAllocatePool3");
+  const auto allocate = (decltype(&ExAllocatePool3))MmGetSystemRoutineAddress(&name);
+  if (!allocate)
+    return ExAllocatePoolZero(NonPagedPoolNxCacheAligned, size, tag);
+  POOL_EXTENDED_PARAMETER param{};
+  param.Type = PoolExtendedParameterNumaNode;
+  param.PreferredNode = node;
+  return allocate(POOL_FLAG_NON_PAGED | POOL_FLAG_CACHE_ALIGNED, size, tag, &param, 1);
+}
+
+static bool vm_pool_read_pubvar(amx64_loader* loader, const char* name, size_t& value) {
+  cell address{};
+  if (!loader->find_pubvar(name, address))
+    return false;
+  const auto index = (size_t)(address / sizeof(cell));
+  if (index >= loader->get_data_count())
+    return false;
+  value = (size_t)loader->get_data()[index];
+  return true;
+}
+
+// A module opts into pooling by declaring `public pawnio_pool_size = N;` for N instances in total, or
+// `public pawnio_pool_per_node = N;` for N replicas on every NUMA node; with both, whichever asks for more wins. Once
+// main has run on the primary, the replicas are cloned from it: they share its code and tables, and start from a copy
+// of its data. Replicas go round-robin over the nodes, with their context and data allocated on their own node.
+// ioctl_ publics then run on whichever instance is idle, except for ioctl_serial_ ones, which always run on the
+// primary. The globals those write are the module's single-instance state, replicas only ever see them as they were
+// after main. On failure the replicas made so far are kept, the load goes on with those.
+static NTSTATUS vm_pool_create(context* ctx) {
+  const auto loader = ctx->loader;
+  const auto node_count = (size_t)KeQueryHighestNodeNumber() + 1;
+  size_t pool_size{}, per_node{};
+  const auto has_size = vm_pool_read_pubvar(loader, "pawnio_pool_size", pool_size);
+  const auto has_per_node = vm_pool_read_pubvar(loader, "pawnio_pool_per_node", per_node);
+  if (!has_size && !has_per_node)
+    return STATUS_SUCCESS;
+
+  // a callback remembers the instance that allocated it and is freed by unload on the primary, which a replica's
+  // allocation would never match. such modules run on the primary only
+  if (loader->uses_native(&to_amx_callback_alloc_wrap)) {
+    DbgPrint("[PawnIO] Module uses callbacks, not pooling it\n");
+    return STATUS_SUCCESS;
+  }
+
+  auto count = pool_size > 0 ? pool_size - 1 : 0;
+  if (per_node <= (k_max_pool_size - 1) / node_count)
+    count = std::max(count, per_node * node_count);
+  else
+    count = k_max_pool_size - 1;
+  // more instances than processors would never all be busy at once
+  count = std::min(count, k_max_pool_size - 1);
+  count = std::min(count, (size_t)KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS) - 1);
+
+  for (size_t i = 0; i < count; ++i) {
+    const auto node = (USHORT)(i % node_count);
+    const auto replica = (context*)vm_allocate_on_node(sizeof(context), 'OIwP', node);
+    if (!replica)
+      return STATUS_NO_MEMORY;
+    const auto data = vm_allocate_on_node(loader->get_data_count() * sizeof(cell), 'LxmA', node);
+    if (!data) {
+      ExFreePool(replica);
+      return STATUS_NO_MEMORY;
+    }
+    replica->mutex.init();
+    replica->node = node;
+    replica->log_id = ctx->log_id;
+    replica->log_counter = ctx->log_counter;
+    const auto replica_loader = new(&replica->loader_storage) amx64_loader();
+    replica->loader = replica_loader;
+    if (replica_loader->init_clone(*loader, replica, data) != amx::loader_error::success || !vm_map_io_windows(replica)) {
+      replica_loader->~amx64_loader();
+      ExFreePool(replica);
+      return STATUS_NO_MEMORY;
+    }
+    ctx->replicas[ctx->replica_count++] = replica;
+  }
+  return STATUS_SUCCESS;
+}
+
+static bool vm_pool_is_serial(const char* name) {
+  return strncmp(name, "ioctl_serial_", 13) == 0;
+}
+
+// publics ending in _bytes get the sizes of their buffers in bytes rather than cells, and unpack them with the
+// packed_ natives
+static bool vm_is_bytes_abi(const char* name) {
+  constexpr static char k_suffix[] = "_bytes";
+  const auto len = strlen(name);
+  return len >= sizeof(k_suffix) - 1 && strcmp(name + len - (sizeof(k_suffix) - 1), k_suffix) == 0;
+}
+
+// Picks the instance to run on, and locks it. Idle replicas are tried without waiting, the ones on the current node
+// first, starting from one picked by the current processor so concurrent callers spread out. The caller only queues
+// up on the primary if every replica is busy, or if what it runs has to run there.
+static context* vm_pool_acquire(context* ctx, bool serial, std::unique_lock<wrapped_fast_mutex>& lock) {
+  const auto count = ctx->replica_count;
+  // precall and postcall hooks are reported against the primary and expect one call at a time on it, so while anyone
+  // is hooked every call queues up there
+  if (count != 0 && !serial && !vm_callback_has_call_hooks()) {
+    const auto first = (size_t)KeGetCurrentProcessorNumberEx(nullptr);
+    const auto node = KeGetCurrentNodeNumber();
+    for (size_t i = 0; i < 2 * count; ++i) {
+      const auto replica = ctx->replicas[(first + i) % count];
+      if ((replica->node == node) != (i < count))
+        continue;
+      std::unique_lock replica_lock{replica->mutex, std::try_to_lock};
+      if (replica_lock.owns_lock()) {
+        // a stale budget for one call is harmless, this only saves locking the primary
+        replica->instruction_budget = ctx->instruction_budget;
+        replica->track_memory = ctx->track_memory;
+        replica->log_enabled = ctx->log_enabled;
+        replica->log_max_per_second = ctx->log_max_per_second;
+        vm_update_single_step(replica);
+        lock = std::move(replica_lock);
+        return replica;
+      }
+    }
+  }
+  lock = std::unique_lock{ctx->mutex};
+  return ctx;
+}
+
+static NTSTATUS vm_destroy_internal(context* ctx) {
+  const auto loader = ctx->loader;
+  const auto copy = const_cast<uint8_t*>(ctx->original_buf);
+  if (ctx->ring)
+    vm_ring_free(ctx->ring);
+  if (ctx->jobs)
+    vm_jobs_free(ctx->jobs);
+  for (size_t i = 0; i < ctx->replica_count; ++i) {
+    const auto replica = ctx->replicas[i];
+    replica->loader->~amx64_loader();
+    ExFreePool(replica);
+  }
+  if (ctx->sampler)
+    vm_sampler_stop(ctx->sampler);
+  if (ctx->profile)
+    ExFreePool(ctx->profile);
+  if (ctx->ioctl_publics)
+    ExFreePool(ctx->ioctl_publics);
+  loader->~amx64_loader();
+  ExFreePool(ctx);
+  ExFreePool(copy);
+  return STATUS_SUCCESS;
+}
+
+NTSTATUS vm_load_binary(PVOID* ctx, PVOID buffer, SIZE_T size) {
+  *ctx = nullptr;
+
+  context* my_ctx{};
+  auto status = vm_load_binary_internal(&my_ctx, buffer, size);
+  if (!NT_SUCCESS(status))
+    return status;
+
+  {
+    std::unique_lock lock{my_ctx->mutex};
+    status = vm_callback_created(my_ctx);
+  }
+  if (NT_SUCCESS(status)) {
+    const auto loader = my_ctx->loader;
+    if (const auto main = loader->get_main()) {
+      std::unique_lock lock{my_ctx->mutex};
+      status = vm_callback_precall(my_ctx, main);
+      if (NT_SUCCESS(status)) {
+        cell ret{};
+        const auto res = vm_call(my_ctx, main, ret);
+        vm_callback_postcall(my_ctx);
+
+        if (res != amx::error::success)
+          status = vm_call_error_status(my_ctx);
+        else
+          status = (NTSTATUS)ret;
+      }
+    }
+  }
+  // a pool only makes calls faster, it mustn't fail a load whose main already ran and may hold resources only unload
+  // gives back
+  if (NT_SUCCESS(status)) {
+    const auto pool_status = vm_pool_create(my_ctx);
+    if (!NT_SUCCESS(pool_status))
+      DbgPrint("[PawnIO] Pooling failed: %X, going on with %u replicas\n", pool_status, (ULONG)my_ctx->replica_count);
+  }
+
+  if (!NT_SUCCESS(status)) {
+    {
+      std::unique_lock lock{my_ctx->mutex};
+      vm_callback_destroyed(my_ctx);
+    }
+    vm_destroy_internal(my_ctx);
+    return status;
+  }
+
+  *ctx = my_ctx;
+  return status;
+}
+
+// runs one ioctl_ public on run_ctx with its buffers already mapped
+static NTSTATUS vm_execute_mapped(
+  context* my_ctx,
+  context* run_ctx,
+  cell fn,
+  const char* name,
+  cell cell_in_va,
+  size_t cell_in_count,
+  cell cell_out_va,
+  size_t cell_out_count,
+  size_t& out_used
+) {
+  out_used = 0;
+  // callbacks always see the handle's context, whichever instance runs the call
+  auto status = vm_callback_precall(my_ctx, fn);
+  if (NT_SUCCESS(status)) {
+    amx64::cell out{};
+    run_ctx->out_size = k_out_size_unset;
+    const auto ret = vm_call_ioctl(run_ctx, fn, out, cell_in_va, (cell)cell_in_count, cell_out_va, (cell)cell_out_count);
+    vm_callback_postcall(my_ctx);
+    if (ret != amx::error::success) {
+      DbgPrint("[PawnIO] Call to %s failed: %X\n", name, ret);
+      status = vm_call_error_status(run_ctx);
+    } else {
+      status = (NTSTATUS)out;
+      // publics that never say otherwise filled the whole buffer
+      const auto reported = (size_t)run_ctx->out_size;
+      out_used = NT_SUCCESS(status) ? (reported < cell_out_count ? reported : cell_out_count) : 0;
+    }
+  }
+  return status;
+}
+
+// The module can read its windows whole, so past the buffers they're zeroed rather than left over from earlier calls.
+static void vm_fill_io_windows(context* run_ctx, const void* in, size_t in_size, const void* out, size_t out_size) {
+  constexpr static size_t k_window_size = k_io_window_cells * sizeof(cell);
+  memcpy(run_ctx->io_in_window, in, in_size);
+  memset((uint8_t*)run_ctx->io_in_window + in_size, 0, k_window_size - in_size);
+  memcpy(run_ctx->io_out_window, out, out_size);
+  memset((uint8_t*)run_ctx->io_out_window + out_size, 0, k_window_size - out_size);
+}
+
+// runs one ioctl_ public on run_ctx, which the caller has locked. out_written is how many bytes of the output buffer
+// the public filled.
+static NTSTATUS vm_execute_locked(
+  context* my_ctx,
+  context* run_ctx,
+  cell fn,
+  const char* name,
+  cell* cell_in_buffer,
+  size_t cell_in_count,
+  cell* cell_out_buffer,
+  size_t cell_out_count,
+  size_t& out_written
+) {
+  const size_t unit = vm_is_bytes_abi(name) ? sizeof(cell) : 1;
+
+  // copying a few cells is cheaper than mapping and unmapping them. the output window gets the output buffer's
+  // contents too, since that's what a mapping would have shown
+  if (cell_in_count <= k_io_window_cells && cell_out_count <= k_io_window_cells) {
+    vm_fill_io_windows(
+      run_ctx,
+      cell_in_buffer,
+      cell_in_count * sizeof(cell),
+      cell_out_buffer,
+      cell_out_count * sizeof(cell)
+    );
+    const auto status = vm_execute_mapped(
+      my_ctx,
+      run_ctx,
+      fn,
+      name,
+      run_ctx->io_in_window_va,
+      cell_in_count * unit,
+      run_ctx->io_out_window_va,
+      cell_out_count * unit,
+      out_written
+    );
+    out_written *= sizeof(cell) / unit;
+    memcpy(cell_out_buffer, run_ctx->io_out_window, out_written);
+    return status;
+  }
+
+  cell cell_in_va{};
+  cell cell_out_va{};
+
+  NTSTATUS status = STATUS_SUCCESS;
+
+  const auto loader = run_ctx->loader;
+  if (loader->map_data(cell_in_buffer, cell_in_count, cell_in_va)) {
+    if (loader->map_data(cell_out_buffer, cell_out_count, cell_out_va)) {
+      status = vm_execute_mapped(
+        my_ctx,
+        run_ctx,
+        fn,
+        name,
+        cell_in_va,
+        cell_in_count * unit,
+        cell_out_va,
+        cell_out_count * unit,
+        out_written
+      );
+      out_written *= sizeof(cell) / unit;
+
+      loader->unmap_data(cell_out_va, cell_out_count);
+    } else {
+      status = STATUS_UNSUCCESSFUL;
+    }
+    loader->unmap_data(cell_in_va, cell_in_count);
+  } else {
+    status = STATUS_UNSUCCESSFUL;
+  }
+
+  return status;
+}
 
-  DEFINE_NATIVE(virtual_read_byte),
-  DEFINE_NATIVE(virtual_read_word),
-  DEFINE_NATIVE(virtual_read_dword),
-  DEFINE_NATIVE(virtual_read_qword),
+static NTSTATUS vm_execute_public(
+  context* my_ctx,
+  cell fn,
+  const char* name,
+  cell* cell_in_buffer,
+  size_t cell_in_count,
+  cell* cell_out_buffer,
+  size_t cell_out_count,
+  size_t& out_written
+) {
+  std::unique_lock<wrapped_fast_mutex> lock{};
+  const auto run_ctx = vm_pool_acquire(my_ctx, vm_pool_is_serial(name), lock);
+  return vm_execute_locked(
+    my_ctx,
+    run_ctx,
+    fn,
+    name,
+    cell_in_buffer,
+    cell_in_count,
+    cell_out_buffer,
+    cell_out_count,
+    out_written
+  );
+}
 
-  DEFINE_NATIVE(virtual_write_byte),
-  DEFINE_NATIVE(virtual_write_word),
-  DEFINE_NATIVE(virtual_write_dword),
-  DEFINE_NATIVE(virtual_write_qword),
+// Byte sized buffers for _bytes publics. Whole cells go the usual way, anything else has to fit the windows: a mapping
+// can't end in the middle of a cell, and the cell it ends in may not be ours to expose.
+static NTSTATUS vm_execute_public_bytes(
+  context* my_ctx,
+  cell fn,
+  const char* name,
+  PVOID in_buffer,
+  size_t in_size,
+  PVOID out_buffer,
+  size_t out_size,
+  size_t& out_written
+) {
+  out_written = 0;
+  if (in_size % sizeof(cell) == 0 && out_size % sizeof(cell) == 0)
+    return vm_execute_public(
+      my_ctx,
+      fn,
+      name,
+      (cell*)in_buffer,
+      in_size / sizeof(cell),
+      (cell*)out_buffer,
+      out_size / sizeof(cell),
+      out_written
+    );
 
-  DEFINE_NATIVE(virtual_cmpxchg_byte2),
-  DEFINE_NATIVE(virtual_cmpxchg_word2),
-  DEFINE_NATIVE(virtual_cmpxchg_dword2),
-  DEFINE_NATIVE(virtual_cmpxchg_qword2),
+  constexpr static size_t k_window_size = k_io_window_cells * sizeof(cell);
+  if (in_size > k_window_size || out_size > k_window_size)
+    return STATUS_INVALID_PARAMETER;
 
-  DEFINE_NATIVE(virtual_alloc),
-  DEFINE_NATIVE(virtual_free),
+  std::unique_lock<wrapped_fast_mutex> lock{};
+  const auto run_ctx = vm_pool_acquire(my_ctx, vm_pool_is_serial(name), lock);
+
+  vm_fill_io_windows(run_ctx, in_buffer, in_size, out_buffer, out_size);
+  const auto status = vm_execute_mapped(
+    my_ctx,
+    run_ctx,
+    fn,
+    name,
+    run_ctx->io_in_window_va,
+    in_size,
+    run_ctx->io_out_window_va,
+    out_size,
+    out_written
+  );
+  memcpy(out_buffer, run_ctx->io_out_window, out_written);
+  return status;
+}
 
-  DEFINE_NATIVE(pci_config_read_byte),
-  DEFINE_NATIVE(pci_config_read_word),
-  DEFINE_NATIVE(pci_config_read_dword),
-  DEFINE_NATIVE(pci_config_read_qword),
+// Buffers sized in bytes, as the execute IOCTLs get them. _bytes publics get them as they are, the rest get the whole
+// cells in them.
+static NTSTATUS vm_execute_sized(
+  context* my_ctx,
+  cell fn,
+  const char* name,
+  PVOID in_buffer,
+  size_t in_size,
+  PVOID out_buffer,
+  size_t out_size,
+  size_t& out_written
+) {
+  if (vm_is_bytes_abi(name))
+    return vm_execute_public_bytes(my_ctx, fn, name, in_buffer, in_size, out_buffer, out_size, out_written);
+  return vm_execute_public(
+    my_ctx,
+    fn,
+    name,
+    (cell*)in_buffer,
+    in_size / sizeof(cell),
+    (cell*)out_buffer,
+    out_size / sizeof(cell),
+    out_written
+  );
+}
 
-  DEFINE_NATIVE(pci_config_write_byte),
-  DEFINE_NATIVE(pci_config_write_word),
-  DEFINE_NATIVE(pci_config_write_dword),
-  DEFINE_NATIVE(pci_config_write_qword),
+// Runs submissions until the ring is empty, the completion ring is full, or one lap of submissions is done, so that a
+// client that keeps submitting can't hold the caller forever. Returns the number of completions posted. The lock only
+// covers the ring itself: a submission and its input are copied out under it, the call runs without it, and its output
+// and completion are posted under it again, so the doorbell, the poll thread and cleanup never wait for a module call.
+// A call that finishes after the ring was detached has nowhere to go and is dropped.
+static ULONG vm_ring_drain(vm_ring* ring) {
+  const auto ctx = ring->ctx;
+  ULONG done = 0;
+  while (done < ring->sq_entries) {
+    pio_ring_submission sub;
+    pio_ring_completion comp{};
+    cell* copy{};
+    {
+      std::unique_lock lock{ring->mutex};
+      // detached, the pages are gone
+      if (!ring->mdl)
+        break;
+      const auto header = ring->header;
+      if (ring->sq_head == ReadULongAcquire(&header->sq_tail))
+        break;
+      // calls still running have their completion slot set aside already
+      if (ring->cq_reserved - ReadULongAcquire(&header->cq_head) >= ring->cq_entries)
+        break;
 
-  DEFINE_NATIVE(invoke),
+      // the client may rewrite the entry at any time, it's read exactly once
+      RtlCopyVolatileMemory(&sub, &ring->sq[ring->sq_head & (ring->sq_entries - 1)], sizeof(sub));
+      WriteULongRelease(&header->sq_head, ++ring->sq_head);
+      ++ring->cq_reserved;
+      comp.user_data = sub.user_data;
+
+      const auto in_end = (uint64_t)sub.in_offset + (uint64_t)sub.in_count * sizeof(cell);
+      const auto out_end = (uint64_t)sub.out_offset + (uint64_t)sub.out_count * sizeof(cell);
+      if (sub.id >= ctx->ioctl_publics_count) {
+        comp.status = STATUS_OBJECT_NAME_NOT_FOUND;
+      } else if (sub.in_offset % sizeof(cell) != 0 || in_end > ring->data_size
+        || sub.out_offset % sizeof(cell) != 0 || out_end > ring->data_size) {
+        comp.status = STATUS_INVALID_PARAMETER;
+      } else {
+        // never the shared pages themselves, the client could change them under the module
+        const auto cells = std::max((size_t)sub.in_count + sub.out_count, (size_t)1);
+        copy = (cell*)ExAllocatePoolZero(NonPagedPoolNx, cells * sizeof(cell), 'cPwP');
+        if (!copy) {
+          comp.status = STATUS_NO_MEMORY;
+        } else {
+          memcpy(copy, ring->data + sub.in_offset, sub.in_count * sizeof(cell));
+          memcpy(copy + sub.in_count, ring->data + sub.out_offset, sub.out_count * sizeof(cell));
+        }
+      }
+    }
 
-  DEFINE_NATIVE(microsleep),
-  DEFINE_NATIVE(microsleep2),
+    size_t out_written{};
+    if (copy) {
+      const auto& pub = ctx->loader->get_public_by_index(ctx->ioctl_publics[sub.id]);
+      comp.status = vm_execute_public(
+        ctx,
+        pub.second,
+        pub.first,
+        copy,
+        sub.in_count,
+        copy + sub.in_count,
+        sub.out_count,
+        out_written
+      );
+      comp.out_size = (ULONG)out_written;
+    }
 
-  DEFINE_NATIVE(qpc),
+    {
+      std::unique_lock lock{ring->mutex};
+      if (ring->mdl) {
+        if (copy)
+          memcpy(ring->data + sub.out_offset, copy + sub.in_count, out_written);
+        ring->cq[ring->cq_tail & (ring->cq_entries - 1)] = comp;
+        WriteULongRelease(&ring->header->cq_tail, ++ring->cq_tail);
+      }
+    }
+    if (copy)
+      ExFreePool(copy);
+    ++done;
+  }
+  return done;
+}
 
-#if defined(ARCH_A64)
+static void vm_ring_poll_thread(PVOID context) {
+  const auto ring = (vm_ring*)context;
+  LARGE_INTEGER timeout{};
+  timeout.QuadPart = -(LONGLONG)ring->poll_interval_ms * 10000;
+  while (STATUS_TIMEOUT == KeWaitForSingleObject(&ring->stop, Executive, KernelMode, FALSE, &timeout))
+    vm_ring_drain(ring);
+  PsTerminateSystemThread(STATUS_SUCCESS);
+}
 
-#elif defined(ARCH_X64)
+// kept apart since nothing with a destructor may share a function with __try
+static NTSTATUS vm_ring_lock_pages(PMDL mdl) {
+  __try {
+    MmProbeAndLockPages(mdl, ExGetPreviousMode(), IoWriteAccess);
+  } __except (EXCEPTION_EXECUTE_HANDLER) {
+    return GetExceptionCode();
+  }
+  return STATUS_SUCCESS;
+}
 
-  DEFINE_NATIVE(query_dell_smm),
+// Stops the ring and unlocks the client's pages, the ring itself stays around until close. Pages still locked when
+// their process goes away bugcheck the system, and with duplicated handles the close may come much later, so this runs
+// at cleanup and when the owning process exits, whichever is first. The poll thread is only told to stop, a call it's
+// in the middle of doesn't hold this up; close waits for it. Callers hold s_rings_mutex.
+static void vm_ring_detach(vm_ring* ring) {
+  if (ring->thread)
+    KeSetEvent(&ring->stop, IO_NO_INCREMENT, FALSE);
+  std::unique_lock lock{ring->mutex};
+  if (ring->mdl) {
+    // unlocking also drops the system mapping
+    MmUnlockPages(ring->mdl);
+    IoFreeMdl(ring->mdl);
+    ring->mdl = nullptr;
+  }
+}
 
-  DEFINE_NATIVE(io_out_byte),
-  DEFINE_NATIVE(io_out_word),
-  DEFINE_NATIVE(io_out_dword),
+static void vm_ring_free(vm_ring* ring) {
+  {
+    std::unique_lock lock{s_rings_mutex};
+    RemoveEntryList(&ring->link);
+    vm_ring_detach(ring);
+  }
+  if (ring->thread) {
+    KeWaitForSingleObject(ring->thread, Executive, KernelMode, FALSE, nullptr);
+    ObDereferenceObject(ring->thread);
+  }
+  ExFreePool(ring);
+}
 
-  DEFINE_NATIVE(io_in_byte),
-  DEFINE_NATIVE(io_in_word),
-  DEFINE_NATIVE(io_in_dword),
+static void vm_process_notify(HANDLE parent_id, HANDLE process_id, BOOLEAN create) {
+  UNREFERENCED_PARAMETER(parent_id);
+  if (create)
+    return;
+  std::unique_lock lock{s_rings_mutex};
+  for (auto entry = s_rings.Flink; entry != &s_rings; entry = entry->Flink) {
+    const auto ring = CONTAINING_RECORD(entry, vm_ring, link);
+    if (ring->process_id == process_id)
+      vm_ring_detach(ring);
+  }
+}
 
-  DEFINE_NATIVE(llwpcb),
-  DEFINE_NATIVE(slwpcb),
+NTSTATUS vm_ring_init() {
+  InitializeListHead(&s_rings);
+  s_rings_mutex.init();
+  return PsSetCreateProcessNotifyRoutine(&vm_process_notify, FALSE);
+}
 
-  DEFINE_NATIVE(cpuid),
+void vm_ring_destroy() {
+  PsSetCreateProcessNotifyRoutine(&vm_process_notify, TRUE);
+}
 
-  DEFINE_NATIVE(cr_read),
-  DEFINE_NATIVE(cr_write),
+NTSTATUS vm_ring_cleanup(PVOID ctx) {
+  if (ctx) {
+    const auto ring = ((context*)ctx)->ring;
+    if (ring) {
+      std::unique_lock lock{s_rings_mutex};
+      vm_ring_detach(ring);
+    }
+  }
+  return STATUS_SUCCESS;
+}
 
-  DEFINE_NATIVE(dr_read),
-  DEFINE_NATIVE(dr_write),
+NTSTATUS vm_ring_register(PVOID ctx, const pio_ring_register* reg) {
+  if (!ctx)
+    return STATUS_DEVICE_NOT_READY;
 
-  DEFINE_NATIVE(xcr_read),
-  DEFINE_NATIVE(xcr_write),
+  const auto my_ctx = (context*)ctx;
+  if (my_ctx->ring)
+    return STATUS_ALREADY_INITIALIZED;
 
-  DEFINE_NATIVE(invlpg),
-  DEFINE_NATIVE(invpcid),
+  const auto sq_entries = reg->sq_entries;
+  const auto cq_entries = reg->cq_entries;
+  const auto is_pow2 = [](ULONG v) { return v != 0 && (v & (v - 1)) == 0; };
+  if (!is_pow2(sq_entries) || sq_entries > k_ring_max_entries || !is_pow2(cq_entries) || cq_entries > k_ring_max_entries)
+    return STATUS_INVALID_PARAMETER;
+  const auto data_offset = sizeof(pio_ring_header) + sq_entries * sizeof(pio_ring_submission)
+    + cq_entries * sizeof(pio_ring_completion);
+  if (reg->region_size < data_offset || reg->region_size > MAXULONG || reg->region % sizeof(cell) != 0)
+    return STATUS_INVALID_PARAMETER;
 
-  DEFINE_NATIVE(readpmc),
+  const auto ring = (vm_ring*)ExAllocatePoolZero(NonPagedPoolNx, sizeof(vm_ring), 'rPwP');
+  if (!ring)
+    return STATUS_NO_MEMORY;
+  // unlinked until installed, removing it is a no-op
+  InitializeListHead(&ring->link);
+
+  auto status = STATUS_INSUFFICIENT_RESOURCES;
+  ring->mdl = IoAllocateMdl((PVOID)(ULONG_PTR)reg->region, (ULONG)reg->region_size, FALSE, FALSE, nullptr);
+  if (ring->mdl) {
+    status = vm_ring_lock_pages(ring->mdl);
+    if (NT_SUCCESS(status)) {
+      const auto base = (uint8_t*)MmGetSystemAddressForMdlSafe(ring->mdl, NormalPagePriority | MdlMappingNoExecute);
+      if (!base) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+      } else {
+        ring->ctx = my_ctx;
+        ring->process_id = PsGetCurrentProcessId();
+        ring->header = (pio_ring_header*)base;
+        ring->sq = (pio_ring_submission*)(base + sizeof(pio_ring_header));
+        ring->cq = (pio_ring_completion*)(ring->sq + sq_entries);
+        ring->data = base + data_offset;
+        ring->data_size = (size_t)reg->region_size - data_offset;
+        ring->sq_entries = sq_entries;
+        ring->cq_entries = cq_entries;
+        ring->mutex.init();
+        // whatever was there before, the rings start out empty
+        ring->header->sq_head = ring->header->sq_tail = 0;
+        ring->header->cq_head = ring->header->cq_tail = 0;
+
+        if (reg->poll_interval_ms != 0) {
+          ring->poll_interval_ms = reg->poll_interval_ms;
+          KeInitializeEvent(&ring->stop, NotificationEvent, FALSE);
+          // this runs in the client's process, a handle in its table could be swapped out from under us
+          OBJECT_ATTRIBUTES attributes;
+          InitializeObjectAttributes(&attributes, nullptr, OBJ_KERNEL_HANDLE, nullptr, nullptr);
+          HANDLE thread{};
+          status = PsCreateSystemThread(&thread, THREAD_ALL_ACCESS, &attributes, nullptr, nullptr, &vm_ring_poll_thread, ring);
+          if (NT_SUCCESS(status)) {
+            status = ObReferenceObjectByHandle(
+              thread,
+              THREAD_ALL_ACCESS,
+              *PsThreadType,
+              KernelMode,
+              (PVOID*)&ring->thread,
+              nullptr
+            );
+            if (!NT_SUCCESS(status)) {
+              KeSetEvent(&ring->stop, IO_NO_INCREMENT, FALSE);
+              ZwWaitForSingleObject(thread, FALSE, nullptr);
+            }
+            ZwClose(thread);
+          }
+        }
 
-  DEFINE_NATIVE(rdtsc),
-  DEFINE_NATIVE(rdtscp),
+        if (NT_SUCCESS(status)) {
+          if (nullptr == _InterlockedCompareExchangePointer((PVOID volatile*)&my_ctx->ring, ring, nullptr)) {
+            std::unique_lock lock{s_rings_mutex};
+            InsertTailList(&s_rings, &ring->link);
+            return STATUS_SUCCESS;
+          }
+          status = STATUS_ALREADY_INITIALIZED;
+          vm_ring_free(ring);
+          return status;
+        }
+      }
+      MmUnlockPages(ring->mdl);
+    }
+    IoFreeMdl(ring->mdl);
+  }
+  ExFreePool(ring);
+  return status;
+}
 
-  DEFINE_NATIVE(rdrand),
-  DEFINE_NATIVE(rdseed),
+NTSTATUS vm_ring_enter(PVOID ctx, ULONG* completed) {
+  *completed = 0;
 
-  DEFINE_NATIVE(lidt),
-  DEFINE_NATIVE(sidt),
+  if (!ctx)
+    return STATUS_DEVICE_NOT_READY;
 
-  DEFINE_NATIVE(lgdt),
-  DEFINE_NATIVE(sgdt),
+  const auto ring = ((context*)ctx)->ring;
+  if (!ring)
+    return STATUS_INVALID_DEVICE_STATE;
+
+  *completed = vm_ring_drain(ring);
+  return STATUS_SUCCESS;
+}
+
+static void vm_jobs_run(vm_jobs* jobs, size_t index, const vm_job& job) {
+  const auto ctx = jobs->ctx;
+  cell in[k_job_max_cells];
+  cell out[k_job_max_cells]{};
+  // the module may scribble over its input, the next run must still get the original
+  memcpy(in, job.in, job.in_count * sizeof(cell));
+  const auto& pub = ctx->loader->get_public_by_index(ctx->ioctl_publics[job.id]);
+  size_t out_written{};
+  const auto status = vm_execute_public(ctx, pub.second, pub.first, in, job.in_count, out, job.out_count, out_written);
+
+  pio_job_record record{};
+  record.timestamp = KeQueryInterruptTime();
+  record.job = (ULONG)index;
+  record.status = status;
+  if (NT_SUCCESS(status)) {
+    // a _bytes public's last partial cell is kept whole
+    record.out_count = (ULONG)((out_written + sizeof(cell) - 1) / sizeof(cell));
+    for (size_t i = 0; i < record.out_count; ++i)
+      record.out[i] = out[i];
+  }
+
+  std::unique_lock lock{jobs->mutex};
+  if (jobs->written - jobs->read == k_jobs_ring_size) {
+    // the oldest result is the least interesting one
+    ++jobs->read;
+    ++jobs->dropped;
+  }
+  jobs->ring[jobs->written++ % k_jobs_ring_size] = record;
+}
+
+static void vm_jobs_thread(PVOID context) {
+  const auto jobs = (vm_jobs*)context;
+  PVOID objects[] = {&jobs->stop, &jobs->changed, &jobs->timer};
+  while (true) {
+    const auto now = KeQueryInterruptTime();
+    ULONG64 next_due = MAXULONG64;
+    ULONG min_period = MAXULONG;
+    {
+      std::unique_lock lock{jobs->mutex};
+      for (const auto& job : jobs->jobs) {
+        if (!job.active)
+          continue;
+        next_due = std::min(next_due, job.next_due);
+        min_period = std::min(min_period, job.period_ms);
+      }
+    }
+
+    if (next_due != MAXULONG64) {
+      LARGE_INTEGER due;
+      due.QuadPart = -(LONGLONG)(next_due > now ? next_due - now : 1);
+      // being an eighth of a period late is fine, and lets the system batch this with other timers
+      KeSetCoalescableTimer(&jobs->timer, due, 0, min_period / 8, nullptr);
+    }
+
+    const auto wait = KeWaitForMultipleObjects(
+      (ULONG)std::size(objects),
+      objects,
+      WaitAny,
+      Executive,
+      KernelMode,
+      FALSE,
+      nullptr,
+      nullptr
+    );
+    if (wait == STATUS_WAIT_0)
+      break;
+    KeCancelTimer(&jobs->timer);
+    if (wait == STATUS_WAIT_0 + 1)
+      continue;
+
+    // everything that's due up to the tolerance runs now rather than in a wakeup of its own
+    const auto run_until = KeQueryInterruptTime() + (ULONG64)(min_period / 8) * 10000;
+    bool ran = false;
+    for (size_t i = 0; i < k_job_max_jobs; ++i) {
+      vm_job job;
+      {
+        std::unique_lock lock{jobs->mutex};
+        auto& slot = jobs->jobs[i];
+        if (!slot.active || slot.next_due > run_until)
+          continue;
+        const auto period = (ULONG64)slot.period_ms * 10000;
+        slot.next_due += period;
+        // when far behind, skip the missed runs rather than catching up with a burst
+        if (slot.next_due <= run_until)
+          slot.next_due = run_until + period;
+        job = slot;
+      }
+      vm_jobs_run(jobs, i, job);
+      ran = true;
+    }
+
+    if (ran && jobs->event)
+      KeSetEvent(jobs->event, IO_NO_INCREMENT, FALSE);
+  }
+  KeCancelTimer(&jobs->timer);
+  PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+static void vm_jobs_free(vm_jobs* jobs) {
+  KeSetEvent(&jobs->stop, IO_NO_INCREMENT, FALSE);
+  KeWaitForSingleObject(jobs->thread, Executive, KernelMode, FALSE, nullptr);
+  ObDereferenceObject(jobs->thread);
+  if (jobs->event)
+    ObDereferenceObject(jobs->event);
+  ExFreePool(jobs);
+}
+
+static NTSTATUS vm_jobs_create(context* ctx, vm_jobs** out) {
+  *out = nullptr;
+  const auto jobs = (vm_jobs*)ExAllocatePoolZero(NonPagedPoolNx, sizeof(vm_jobs), 'jPwP');
+  if (!jobs)
+    return STATUS_NO_MEMORY;
+  jobs->ctx = ctx;
+  jobs->mutex.init();
+  // resets itself when the wait is satisfied, so a stale expiry can't keep waking the thread
+  KeInitializeTimerEx(&jobs->timer, SynchronizationTimer);
+  KeInitializeEvent(&jobs->stop, NotificationEvent, FALSE);
+  KeInitializeEvent(&jobs->changed, SynchronizationEvent, FALSE);
+
+  // this runs in the client's process, a handle in its table could be swapped out from under us
+  OBJECT_ATTRIBUTES attributes;
+  InitializeObjectAttributes(&attributes, nullptr, OBJ_KERNEL_HANDLE, nullptr, nullptr);
+  HANDLE thread{};
+  auto status = PsCreateSystemThread(&thread, THREAD_ALL_ACCESS, &attributes, nullptr, nullptr, &vm_jobs_thread, jobs);
+  if (NT_SUCCESS(status)) {
+    status = ObReferenceObjectByHandle(
+      thread,
+      THREAD_ALL_ACCESS,
+      *PsThreadType,
+      KernelMode,
+      (PVOID*)&jobs->thread,
+      nullptr
+    );
+    if (!NT_SUCCESS(status)) {
+      KeSetEvent(&jobs->stop, IO_NO_INCREMENT, FALSE);
+      ZwWaitForSingleObject(thread, FALSE, nullptr);
+    }
+    ZwClose(thread);
+  }
+  if (!NT_SUCCESS(status)) {
+    ExFreePool(jobs);
+    return status;
+  }
+
+  *out = jobs;
+  return STATUS_SUCCESS;
+}
+
+NTSTATUS vm_job_register(PVOID ctx, PVOID in_buffer, SIZE_T in_size, ULONG* job_index) {
+  *job_index = 0;
+
+  if (!ctx)
+    return STATUS_DEVICE_NOT_READY;
+
+  if (in_size < sizeof(pio_job_register))
+    return STATUS_INVALID_PARAMETER;
+  const auto reg = (const pio_job_register*)in_buffer;
+  const auto my_ctx = (context*)ctx;
+  if (reg->id >= my_ctx->ioctl_publics_count)
+    return STATUS_OBJECT_NAME_NOT_FOUND;
+  if (reg->period_ms == 0 || reg->period_ms > MAXLONG)
+    return STATUS_INVALID_PARAMETER;
+  if (reg->in_count > k_job_max_cells || reg->out_count > k_job_max_cells)
+    return STATUS_INVALID_PARAMETER;
+  if (in_size != sizeof(pio_job_register) + reg->in_count * sizeof(cell))
+    return STATUS_INVALID_PARAMETER;
+
+  PKEVENT event{};
+  if (reg->event) {
+    const auto status = ObReferenceObjectByHandle(
+      (HANDLE)(ULONG_PTR)reg->event,
+      EVENT_MODIFY_STATE,
+      *ExEventObjectType,
+      ExGetPreviousMode(),
+      (PVOID*)&event,
+      nullptr
+    );
+    if (!NT_SUCCESS(status))
+      return status;
+  }
+
+  // set once and only freed when the handle is closed, so no lock is needed to use it
+  auto jobs = my_ctx->jobs;
+  if (!jobs) {
+    // creating the thread has to happen at passive level, outside of any lock
+    vm_jobs* created{};
+    const auto status = vm_jobs_create(my_ctx, &created);
+    if (!NT_SUCCESS(status)) {
+      if (event)
+        ObDereferenceObject(event);
+      return status;
+    }
+    jobs = (vm_jobs*)_InterlockedCompareExchangePointer((PVOID volatile*)&my_ctx->jobs, created, nullptr);
+    if (jobs)
+      vm_jobs_free(created);
+    else
+      jobs = created;
+  }
+
+  std::unique_lock lock{jobs->mutex};
+  size_t index;
+  for (index = 0; index < k_job_max_jobs; ++index)
+    if (!jobs->jobs[index].active)
+      break;
+  if (index == k_job_max_jobs) {
+    if (event)
+      ObDereferenceObject(event);
+    return STATUS_QUOTA_EXCEEDED;
+  }
+
+  auto& job = jobs->jobs[index];
+  job = {};
+  job.id = reg->id;
+  job.period_ms = reg->period_ms;
+  job.next_due = KeQueryInterruptTime() + (ULONG64)reg->period_ms * 10000;
+  job.in_count = reg->in_count;
+  job.out_count = reg->out_count;
+  memcpy(job.in, reg + 1, reg->in_count * sizeof(cell));
+  job.active = true;
+
+  if (event) {
+    // the thread only reads it between wakeups, under no lock, so the old one has to stay valid until the handle is
+    // closed; keep whichever came first
+    if (!jobs->event)
+      jobs->event = event;
+    else
+      ObDereferenceObject(event);
+  }
+
+  KeSetEvent(&jobs->changed, IO_NO_INCREMENT, FALSE);
+  *job_index = (ULONG)index;
+  return STATUS_SUCCESS;
+}
+
+NTSTATUS vm_job_unregister(PVOID ctx, ULONG job_index) {
+  if (!ctx)
+    return STATUS_DEVICE_NOT_READY;
+
+  const auto jobs = ((context*)ctx)->jobs;
+  if (!jobs || job_index >= k_job_max_jobs)
+    return STATUS_INVALID_PARAMETER;
+
+  std::unique_lock lock{jobs->mutex};
+  auto& job = jobs->jobs[job_index];
+  if (!job.active)
+    return STATUS_INVALID_PARAMETER;
+  job.active = false;
+  KeSetEvent(&jobs->changed, IO_NO_INCREMENT, FALSE);
+  return STATUS_SUCCESS;
+}
+
+NTSTATUS vm_job_query(PVOID ctx, PVOID out_buffer, SIZE_T out_size, SIZE_T* written) {
+  *written = 0;
+
+  if (!ctx)
+    return STATUS_DEVICE_NOT_READY;
+
+  if (out_size < sizeof(pio_jobs_header))
+    return STATUS_BUFFER_TOO_SMALL;
+
+  const auto jobs = ((context*)ctx)->jobs;
+  if (!jobs)
+    return STATUS_INVALID_DEVICE_STATE;
+
+  const auto header = (pio_jobs_header*)out_buffer;
+  const auto records = (pio_job_record*)(header + 1);
+  const auto max_count = (out_size - sizeof(pio_jobs_header)) / sizeof(pio_job_record);
+
+  std::unique_lock lock{jobs->mutex};
+  const auto count = (size_t)std::min<uint64_t>(jobs->written - jobs->read, max_count);
+  for (size_t i = 0; i < count; ++i)
+    records[i] = jobs->ring[(jobs->read + i) % k_jobs_ring_size];
+  jobs->read += count;
+  header->total_records = jobs->written;
+  header->dropped_records = jobs->dropped;
+  header->record_count = (ULONG)count;
+  header->reserved = 0;
+
+  *written = sizeof(pio_jobs_header) + count * sizeof(pio_job_record);
+  return STATUS_SUCCESS;
+}
+
+// checks the name header the execute IOCTLs start with and resolves it
+static NTSTATUS vm_resolve_ioctl_name(context* ctx, PVOID in_buffer, SIZE_T in_size, char (&arr)[k_max_ioctl_name + 1], cell& fn) {
+  if (in_size < k_max_ioctl_name)
+    return STATUS_INVALID_PARAMETER;
+  arr[k_max_ioctl_name] = 0;
+  memcpy(arr, in_buffer, k_max_ioctl_name);
+  if (strlen(arr) == k_max_ioctl_name)
+    return STATUS_INVALID_PARAMETER;
+
+  if (strncmp(arr, "ioctl_", 6) != 0)
+    return STATUS_INVALID_PARAMETER;
+
+  if (!ctx)
+    return STATUS_DEVICE_NOT_READY;
+
+  fn = ctx->loader->get_public(arr);
+  if (!fn)
+    return STATUS_OBJECT_NAME_NOT_FOUND;
+  return STATUS_SUCCESS;
+}
+
+NTSTATUS vm_execute_function(
+  PVOID ctx,
+  PVOID in_buffer,
+  SIZE_T in_size,
+  PVOID out_buffer,
+  SIZE_T out_size,
+  SIZE_T* written
+) {
+  *written = 0;
+  const auto my_ctx = (context*)ctx;
+  char arr[k_max_ioctl_name + 1];
+  cell fn{};
+  const auto status = vm_resolve_ioctl_name(my_ctx, in_buffer, in_size, arr, fn);
+  if (!NT_SUCCESS(status))
+    return status;
+
+  // call function
+  return vm_execute_sized(
+    my_ctx,
+    fn,
+    arr,
+    (char*)in_buffer + k_max_ioctl_name,
+    in_size - k_max_ioctl_name,
+    out_buffer,
+    out_size,
+    *written
+  );
+}
+
+NTSTATUS vm_execute_function_by_id(
+  PVOID ctx,
+  PVOID in_buffer,
+  SIZE_T in_size,
+  PVOID out_buffer,
+  SIZE_T out_size,
+  SIZE_T* written
+) {
+  *written = 0;
+  if (in_size < sizeof(ULONG64))
+    return STATUS_INVALID_PARAMETER;
+
+  if (!ctx)
+    return STATUS_DEVICE_NOT_READY;
+
+  const auto my_ctx = (context*)ctx;
+  const auto id = *(ULONG64*)in_buffer;
+  if (id >= my_ctx->ioctl_publics_count)
+    return STATUS_OBJECT_NAME_NOT_FOUND;
+
+  const auto& pub = my_ctx->loader->get_public_by_index(my_ctx->ioctl_publics[id]);
+  return vm_execute_sized(
+    my_ctx,
+    pub.second,
+    pub.first,
+    (char*)in_buffer + sizeof(ULONG64),
+    in_size - sizeof(ULONG64),
+    out_buffer,
+    out_size,
+    *written
+  );
+}
+
+NTSTATUS vm_execute_batch(
+  PVOID ctx,
+  PVOID in_buffer,
+  SIZE_T in_size,
+  PVOID out_buffer,
+  SIZE_T out_size,
+  SIZE_T* written
+) {
+  *written = 0;
+  if (!ctx)
+    return STATUS_DEVICE_NOT_READY;
+
+  if (in_size < sizeof(pio_batch_header))
+    return STATUS_INVALID_PARAMETER;
+
+  const auto my_ctx = (context*)ctx;
+  const auto in_header = (const pio_batch_header*)in_buffer;
+  const auto call_count = (size_t)in_header->call_count;
+  if (call_count == 0 || call_count > k_batch_max_calls)
+    return STATUS_INVALID_PARAMETER;
+  if (in_size < sizeof(pio_batch_header) + call_count * sizeof(pio_batch_call))
+    return STATUS_INVALID_PARAMETER;
+  const auto results_size = call_count * sizeof(pio_batch_result);
+  if (out_size < results_size)
+    return STATUS_BUFFER_TOO_SMALL;
+
+  // the buffers are one and the same for buffered IOCTLs, and outputs would overwrite inputs of later calls
+  const auto in_copy = (uint8_t*)ExAllocatePoolZero(NonPagedPoolNx, in_size, 'bPwP');
+  if (!in_copy)
+    return STATUS_NO_MEMORY;
+  memcpy(in_copy, in_buffer, in_size);
+  const auto calls = (const pio_batch_call*)(in_copy + sizeof(pio_batch_header));
+
+  // validate everything up front, so that a malformed batch runs nothing
+  auto status = STATUS_SUCCESS;
+  bool serial = false;
+  for (size_t i = 0; i < call_count && NT_SUCCESS(status); ++i) {
+    const auto& call = calls[i];
+    const auto in_end = (uint64_t)call.in_offset + (uint64_t)call.in_count * sizeof(cell);
+    const auto out_end = (uint64_t)call.out_offset + (uint64_t)call.out_count * sizeof(cell);
+    if (call.id >= my_ctx->ioctl_publics_count)
+      status = STATUS_OBJECT_NAME_NOT_FOUND;
+    else if (call.in_offset % sizeof(cell) != 0 || in_end > in_size)
+      status = STATUS_INVALID_PARAMETER;
+    else if (call.out_offset % sizeof(cell) != 0 || call.out_offset < results_size || out_end > out_size)
+      status = STATUS_INVALID_PARAMETER;
+    else if (vm_pool_is_serial(my_ctx->loader->get_public_by_index(my_ctx->ioctl_publics[call.id]).first))
+      serial = true;
+  }
 
-  DEFINE_NATIVE(mxcsr_read),
-  DEFINE_NATIVE(mxcsr_write),
+  if (NT_SUCCESS(status)) {
+    // the output shares the buffer with the input, what no call writes must not go back as whatever the input had
+    // there
+    const auto results = (pio_batch_result*)out_buffer;
+    memset(out_buffer, 0, out_size);
+    size_t extent = results_size;
+
+    std::unique_lock<wrapped_fast_mutex> lock{};
+    const auto run_ctx = vm_pool_acquire(my_ctx, serial, lock);
+    for (size_t i = 0; i < call_count; ++i) {
+      const auto& call = calls[i];
+      const auto& pub = my_ctx->loader->get_public_by_index(my_ctx->ioctl_publics[call.id]);
+      size_t out_written{};
+      const auto call_status = vm_execute_locked(
+        my_ctx,
+        run_ctx,
+        pub.second,
+        pub.first,
+        (cell*)(in_copy + call.in_offset),
+        call.in_count,
+        (cell*)((uint8_t*)out_buffer + call.out_offset),
+        call.out_count,
+        out_written
+      );
+      results[i].status = call_status;
+      results[i].out_size = (ULONG)out_written;
+      extent = std::max(extent, (size_t)call.out_offset + out_written);
+    }
+    *written = extent;
+  }
 
-  DEFINE_NATIVE(stac),
-  DEFINE_NATIVE(clac),
+  ExFreePool(in_copy);
+  return status;
+}
 
-  DEFINE_NATIVE(halt),
+NTSTATUS vm_functions_query(PVOID ctx, PVOID out_buffer, SIZE_T out_size, SIZE_T* written) {
+  *written = 0;
 
-  DEFINE_NATIVE(ud2),
+  if (!ctx)
+    return STATUS_DEVICE_NOT_READY;
 
-  DEFINE_NATIVE(int3),
+  if (out_size < sizeof(pio_functions_header))
+    return STATUS_BUFFER_TOO_SMALL;
 
-  DEFINE_NATIVE(int2c),
+  // the table is immutable after load, no need to lock
+  const auto my_ctx = (context*)ctx;
+  const auto count = my_ctx->ioctl_publics_count;
 
-  DEFINE_NATIVE(wbinvd),
+  const auto header = (pio_functions_header*)out_buffer;
+  header->function_count = (ULONG)count;
+  header->reserved = 0;
 
-#endif
+  const auto required = sizeof(pio_functions_header) + count * sizeof(pio_function);
+  if (out_size < required) {
+    *written = sizeof(pio_functions_header);
+    return STATUS_BUFFER_OVERFLOW;
+  }
 
-#undef DEFINE_NATIVE
-};
+  const auto functions = (pio_function*)(header + 1);
+  for (size_t i = 0; i < count; ++i) {
+    const auto name = my_ctx->loader->get_public_by_index(my_ctx->ioctl_publics[i]).first;
+    auto& function = functions[i];
+    function = {};
+    function.id = (ULONG)i;
+    // checked to fit when the table was built
+    memcpy(function.name, name, strlen(name));
+  }
 
-void __CRTDECL operator delete(void*, size_t) noexcept {
-  __debugbreak();
+  *written = required;
+  return STATUS_SUCCESS;
 }
 
-constexpr static uint8_t k_pubkey_namazso_2023[] = {0x52, 0x53, 0x41, 0x31, 0x00, 0x10, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x01, 0xB5, 0x45, 0xB8, 0x15, 0xF0, 0x2A, 0xEB, 0xCA, 0xC9, 0x35, 0x8F, 0x54, 0x15, 0x83, 0x12, 0x2C, 0xC3, 0xF3, 0x5E, 0x1E, 0xE7, 0xFB, 0xD3, 0xE1, 0x68, 0x73, 0x3B, 0x36, 0xC0, 0x5C, 0x6F, 0xD3, 0xBA, 0xF4, 0xD0, 0xA9, 0x9B, 0x6E, 0x9C, 0x66, 0x43, 0x2F, 0xC9, 0xB2, 0x82, 0xDF, 0x24, 0x6D, 0x8F, 0x5F, 0x45, 0xAF, 0x02, 0xDD, 0x6A, 0xEF, 0x04, 0x01, 0x74, 0x69, 0xC3, 0x20, 0x70, 0xDB, 0x3F, 0x05, 0x97, 0x9E, 0xE6, 0x01, 0x6B, 0x9E, 0x28, 0x53, 0x03, 0x59, 0x02, 0x98, 0x4C, 0x41, 0xAB, 0xB2, 0x56, 0x5F, 0xD6, 0x24, 0x98, 0xD1, 0xB3, 0xF9, 0xF8, 0x46, 0xC7, 0x21, 0x4B, 0xDF, 0xFD, 0xF2, 0x88, 0x2A, 0xCE, 0xDC, 0x75, 0x36, 0x40, 0xC2, 0x5E, 0x0B, 0x26, 0x17, 0x7A, 0x3D, 0xD6, 0x34, 0xD7, 0x47, 0xD6, 0x61, 0xE1, 0x33, 0xD7, 0x7A, 0x00, 0x7E, 0x9F, 0xEB, 0x92, 0x33, 0x52, 0x65, 0x8E, 0xF8, 0x7C, 0x49, 0xD4, 0x22, 0xB8, 0x22, 0xBD, 0x59, 0x56, 0xBC, 0xD5, 0x1B, 0x64, 0x4C, 0x91, 0x50, 0xAB, 0x1F, 0x67, 0x9F, 0x84, 0xDD, 0x8B, 0x4F, 0xFC, 0x28, 0x26, 0x52, 0x36, 0x49, 0x67, 0x0D, 0x6C, 0xA4, 0xA1, 0xAA, 0xEC, 0x2B, 0xB0, 0x05, 0x09, 0x08, 0x20, 0x38, 0x82, 0xAE, 0x47, 0xB9, 0x3C, 0xAE, 0x50, 0xBF, 0x93, 0x69, 0x94, 0xB5, 0x98, 0x7C, 0xA8, 0x2E, 0xA9, 0x8E, 0x7B, 0xC2, 0xB2, 0x12, 0xB9, 0xB1, 0x62, 0x46, 0x3C, 0xED, 0x24, 0x9C, 0x89, 0xE0, 0xB8, 0x46, 0x26, 0x1A, 0x5A, 0x08, 0xD6, 0xF0, 0x2A, 0xA3, 0x28, 0xB6, 0x73, 0x60, 0xAE, 0xC3, 0x2D, 0x4C, 0x5A, 0x24, 0xF1, 0x58, 0x4C, 0x51, 0xD2, 0x66, 0xE9, 0xD9, 0x61, 0x98, 0x4D, 0xDE, 0x94, 0xD8, 0x44, 0x1F, 0x62, 0xF6, 0x4E, 0xF9, 0x73, 0x44, 0xA4, 0x7A, 0x2C, 0x2D, 0xC1, 0xDB, 0x4F, 0x58, 0xD6, 0x70, 0xB2, 0x6E, 0xE8, 0xD9, 0x50, 0x01, 0x35, 0x4F, 0x39, 0x49, 0x2E, 0x09, 0x76, 0x47, 0x9C, 0x3C, 0x7E, 0x72, 0x33, 0xCA, 0x13, 0xD7, 0x29, 0x82, 0xFB, 0x14, 0xAD, 0x4E, 0xC3, 0xA6, 0xC6, 0x4C, 0x18, 0x84, 0xB5, 0x83, 0x7A, 0xF0, 0x99, 0xBA, 0x1D, 0x56, 0xD2, 0xA2, 0xDF, 0x14, 0x34, 0x01, 0x6F, 0x83, 0x8D, 0xB8, 0xA0, 0x16, 0x2C, 0x36, 0x90, 0x0F, 0x96, 0x2D, 0x3B, 0x80, 0x58, 0x5C, 0xE7, 0x9D, 0x0D, 0x73, 0x38, 0xCA, 0xEE, 0x43, 0xF7, 0xC0, 0x37, 0xA4, 0xEA, 0xDD, 0x76, 0xCC, 0xA2, 0xF3, 0x54, 0xC8, 0x45, 0xC9, 0xBE, 0x3F, 0xCE, 0xAA, 0x98, 0x2F, 0x4C, 0x97, 0x87, 0x56, 0x00, 0x81, 0x6A, 0x7A, 0x41, 0x52, 0xF7, 0xF9, 0x0D, 0xEE, 0x5D, 0xB6, 0x05, 0x1F, 0x40, 0x9F, 0xDE, 0x75, 0x97, 0xD5, 0x8F, 0x28, 0x04, 0xDA, 0x57, 0xA2, 0x76, 0x52, 0x49, 0x35, 0xAC, 0x54, 0xF3, 0x09, 0xA6, 0x68, 0xEC, 0x84, 0xB8, 0x87, 0xD9, 0xBE, 0x26, 0xED, 0xFD, 0x75, 0x7D, 0x2A, 0x1B, 0x55, 0x18, 0x31, 0xA7, 0xA0, 0x44, 0xC5, 0x4A, 0x05, 0xD2, 0x55, 0x44, 0x70, 0x1D, 0x35, 0xE4, 0x61, 0x03, 0x5D, 0x82, 0x3C, 0x48, 0x40, 0x5F, 0x58, 0x64, 0x4E, 0xFF, 0xA6, 0xA1, 0x24, 0x7A, 0xAC, 0xF0, 0xF8, 0x3F, 0x9E, 0x9B, 0xE0, 0x53, 0x04, 0x55, 0xB1, 0xED, 0xDC, 0xC0, 0xC9, 0x9E, 0x5E, 0x31, 0x46, 0x09, 0x83, 0x51, 0x41, 0xBD, 0x41, 0x73, 0xC0, 0xD8, 0x36, 0x23, 0xAE, 0x0B, 0xDF, 0x89, 0x67, 0x2A, 0xC7, 0x56, 0x36, 0xA8, 0xE2, 0x76, 0xB8, 0xCB, 0x75, 0xA1, 0xF0, 0x7C, 0xAC, 0x4D, 0xCD, 0x56, 0xBB, 0x6A, 0x03, 0xCA, 0x7A, 0x89, 0xD2, 0x06, 0xE9, 0x02, 0x48, 0x17, 0x2F, 0xCF, 0xBC, 0xC1, 0xB6, 0xF7, 0xBF, 0x8A, 0xC1, 0xA7, 0x9B};
-
-constexpr static trusted_pubkey k_trusted_keys[] = {
-  {k_pubkey_namazso_2023, sizeof(k_pubkey_namazso_2023)},
-  {}
-};
+NTSTATUS vm_set_instruction_budget(PVOID ctx, uint64_t budget) {
+  if (!ctx)
+    return STATUS_DEVICE_NOT_READY;
 
-const trusted_pubkey* pawnio_trusted_keys() {
-  return k_trusted_keys;
+  const auto my_ctx = (context*)ctx;
+  std::unique_lock lock{my_ctx->mutex};
+  my_ctx->instruction_budget = budget;
+  vm_update_single_step(my_ctx);
+  return STATUS_SUCCESS;
 }
 
-static NTSTATUS check_signature(const void* mem, size_t len, const uint8_t* sig, size_t sig_len) {
-  sha256_buf sha256;
-  auto status = calculate_sha256(mem, len, &sha256);
-  if (!NT_SUCCESS(status))
-    return status;
+NTSTATUS vm_profile_control(PVOID ctx, bool enable) {
+  if (!ctx)
+    return STATUS_DEVICE_NOT_READY;
 
-  for (auto it = k_trusted_keys; it->pubkey_data; ++it) {
-    status = verify_sig(sha256, sig, sig_len, it->pubkey_data, it->pubkey_len);
-    if (NT_SUCCESS(status))
-      break;
+  const auto my_ctx = (context*)ctx;
+  const auto loader = my_ctx->loader;
+  const auto publics_count = loader->get_publics_count();
+  const auto size = sizeof(vm_profile) + publics_count * sizeof(pio_profile_public);
+
+  // allocate outside the lock, a call may be holding it for a while
+  vm_profile* new_profile{};
+  if (enable) {
+    new_profile = (vm_profile*)ExAllocatePoolZero(NonPagedPoolNx, size, 'fPwP');
+    if (!new_profile)
+      return STATUS_NO_MEMORY;
+    new_profile->publics_count = publics_count;
+    new_profile->current_public = publics_count;
+    new_profile->publics = (pio_profile_public*)(new_profile + 1);
+    for (size_t i = 0; i < publics_count; ++i)
+      new_profile->publics[i].cip = loader->get_public_by_index(i).second;
   }
 
-  return status;
+  vm_profile* old_profile;
+  {
+    std::unique_lock lock{my_ctx->mutex};
+    old_profile = my_ctx->profile;
+    my_ctx->profile = new_profile;
+    vm_update_single_step(my_ctx);
+  }
+
+  if (old_profile)
+    ExFreePool(old_profile);
+
+  return STATUS_SUCCESS;
 }
 
-static NTSTATUS vm_load_binary_internal(context** ctx, PVOID buffer, SIZE_T size) {
-  *ctx = nullptr;
+NTSTATUS vm_profile_query(PVOID ctx, PVOID out_buffer, SIZE_T out_size, SIZE_T* written) {
+  *written = 0;
 
-  if (size < 4)
-    return STATUS_INVALID_PARAMETER;
-  const auto sig_len = *(PULONG)buffer;
-  if (sig_len > (size - 4))
-    return STATUS_INVALID_PARAMETER;
+  if (!ctx)
+    return STATUS_DEVICE_NOT_READY;
 
-  const auto mem = (uint8_t*)buffer + 4 + sig_len;
-  const auto len = size - 4 - sig_len;
+  if (out_size < sizeof(pio_profile_header))
+    return STATUS_BUFFER_TOO_SMALL;
 
-  auto status = check_signature(mem, len, (uint8_t*)buffer + 4, sig_len);
+  const auto my_ctx = (context*)ctx;
+  std::unique_lock lock{my_ctx->mutex};
+
+  const auto profile = my_ctx->profile;
+  if (!profile)
+    return STATUS_INVALID_DEVICE_STATE;
+
+  ULONG hot_count = 0;
+  for (const auto& slot : profile->hot)
+    if (slot.count)
+      ++hot_count;
+
+  const auto header = (pio_profile_header*)out_buffer;
+  header->total_instructions = profile->total_instructions;
+  header->dropped_hot_samples = profile->dropped_hot_samples;
+  header->opcode_count = k_profile_opcode_count;
+  header->public_count = (ULONG)profile->publics_count;
+  header->hot_count = hot_count;
+  header->reserved = 0;
+
+  const auto opcodes_size = sizeof(profile->opcodes);
+  const auto publics_size = profile->publics_count * sizeof(pio_profile_public);
+  const auto required = sizeof(pio_profile_header) + opcodes_size + publics_size + hot_count * sizeof(pio_profile_hot);
+  if (out_size < required) {
+    // the header tells the caller how big a buffer to come back with
+    *written = sizeof(pio_profile_header);
+    return STATUS_BUFFER_OVERFLOW;
+  }
 
-#ifdef PAWNIO_UNRESTRICTED
-  DbgPrint("[PawnIO] Signature check result: %X\n", status);
-  status = STATUS_SUCCESS;
-#endif
+  auto it = (uint8_t*)(header + 1);
+  memcpy(it, profile->opcodes, opcodes_size);
+  it += opcodes_size;
+  memcpy(it, profile->publics, publics_size);
+  it += publics_size;
+  for (const auto& slot : profile->hot) {
+    if (slot.count) {
+      memcpy(it, &slot, sizeof(slot));
+      it += sizeof(slot);
+    }
+  }
 
-  if (NT_SUCCESS(status)) {
-    // extra copy
-    const auto copy = (uint8_t*)ExAllocatePoolZero(NonPagedPoolNxCacheAligned, size, 'cpmA');
-    if (!copy) {
-      status = STATUS_NO_MEMORY;
-    } else {
-      // load
-      const auto my_ctx = (context*)ExAllocatePoolZero(NonPagedPoolNxCacheAligned, sizeof(context), 'OIwP');
-      if (!my_ctx) {
-        status = STATUS_NO_MEMORY;
-      } else {
-        memcpy(copy, buffer, size);
-        my_ctx->original_buf = copy;
-        my_ctx->original_buf_size = size;
-        my_ctx->mutex.init();
-        const auto loader = new(&my_ctx->loader_storage) amx64_loader();
-        my_ctx->loader = loader;
+  *written = required;
+  return STATUS_SUCCESS;
+}
 
-        const amx64_loader::callbacks_arg callbacks
-        {
-          .natives = NATIVES,
-          .natives_count = std::size(NATIVES),
-          .on_single_step = nullptr,
-          .on_break = nullptr,
-          .user_data = my_ctx
-        };
+NTSTATUS vm_sampling_control(PVOID ctx, ULONG period_ms) {
+  if (!ctx)
+    return STATUS_DEVICE_NOT_READY;
 
-        const auto result = loader->init(mem, len, callbacks);
+  if (period_ms > MAXLONG)
+    return STATUS_INVALID_PARAMETER;
 
-        if (result != amx::loader_error::success) {
-          status = STATUS_UNSUCCESSFUL;
-        } else {
-          *ctx = my_ctx;
-          return STATUS_SUCCESS;
-        }
+  const auto my_ctx = (context*)ctx;
 
-        loader->~amx64_loader();
-        ExFreePool(my_ctx);
-      }
+  vm_sampler* new_sampler{};
+  if (period_ms) {
+    new_sampler = (vm_sampler*)ExAllocatePoolZero(NonPagedPoolNx, sizeof(vm_sampler), 'sPwP');
+    if (!new_sampler)
+      return STATUS_NO_MEMORY;
+    new_sampler->ctx = my_ctx;
+    KeInitializeSpinLock(&new_sampler->lock);
+    KeInitializeDpc(&new_sampler->dpc, &vm_sampler_dpc, new_sampler);
+    KeInitializeTimerEx(&new_sampler->timer, NotificationTimer);
+  }
 
-      ExFreePool(copy);
+  vm_sampler* old_sampler;
+  {
+    std::unique_lock lock{my_ctx->mutex};
+    old_sampler = my_ctx->sampler;
+    my_ctx->sampler = new_sampler;
+    // armed before anyone else can swap it out and free it. stopping has to wait for the lock to be dropped, since
+    // flushing DPCs needs PASSIVE_LEVEL
+    if (new_sampler) {
+      LARGE_INTEGER due;
+      due.QuadPart = -(LONGLONG)period_ms * 10000;
+      KeSetTimerEx(&new_sampler->timer, due, (LONG)period_ms, &new_sampler->dpc);
     }
   }
-  return status;
+
+  if (old_sampler)
+    vm_sampler_stop(old_sampler);
+
+  return STATUS_SUCCESS;
 }
 
-static NTSTATUS vm_destroy_internal(context* ctx) {
-  const auto loader = ctx->loader;
-  const auto copy = const_cast<uint8_t*>(ctx->original_buf);
-  loader->~amx64_loader();
-  ExFreePool(ctx);
-  ExFreePool(copy);
+NTSTATUS vm_sampling_query(PVOID ctx, PVOID out_buffer, SIZE_T out_size, SIZE_T* written) {
+  *written = 0;
+
+  if (!ctx)
+    return STATUS_DEVICE_NOT_READY;
+
+  if (out_size < sizeof(pio_sampling_header))
+    return STATUS_BUFFER_TOO_SMALL;
+
+  const auto my_ctx = (context*)ctx;
+  std::unique_lock lock{my_ctx->mutex};
+
+  const auto sampler = my_ctx->sampler;
+  if (!sampler)
+    return STATUS_INVALID_DEVICE_STATE;
+
+  const auto header = (pio_sampling_header*)out_buffer;
+  const auto samples = (pio_sample*)(header + 1);
+  const auto max_count = (out_size - sizeof(pio_sampling_header)) / sizeof(pio_sample);
+
+  KIRQL irql;
+  KeAcquireSpinLock(&sampler->lock, &irql);
+  const auto count = (size_t)std::min<uint64_t>(sampler->written - sampler->read, max_count);
+  for (size_t i = 0; i < count; ++i)
+    samples[i] = sampler->ring[(sampler->read + i) % k_sampler_ring_size];
+  sampler->read += count;
+  header->total_samples = sampler->written;
+  header->dropped_samples = sampler->dropped;
+  KeReleaseSpinLock(&sampler->lock, irql);
+
+  header->sample_count = (ULONG)count;
+  header->reserved = 0;
+
+  *written = sizeof(pio_sampling_header) + count * sizeof(pio_sample);
   return STATUS_SUCCESS;
 }
 
-NTSTATUS vm_load_binary(PVOID* ctx, PVOID buffer, SIZE_T size) {
-  *ctx = nullptr;
+NTSTATUS vm_symbols_query(PVOID ctx, PVOID out_buffer, SIZE_T out_size, SIZE_T* written) {
+  *written = 0;
 
-  context* my_ctx{};
-  auto status = vm_load_binary_internal(&my_ctx, buffer, size);
-  if (!NT_SUCCESS(status))
-    return status;
+  if (!ctx)
+    return STATUS_DEVICE_NOT_READY;
 
-  {
-    std::unique_lock lock{my_ctx->mutex};
-    status = vm_callback_created(my_ctx);
-  }
-  if (NT_SUCCESS(status)) {
-    const auto loader = my_ctx->loader;
-    if (const auto main = loader->get_main()) {
-      std::unique_lock lock{my_ctx->mutex};
-      status = vm_callback_precall(my_ctx, main);
-      if (NT_SUCCESS(status)) {
-        cell ret{};
-        const auto res = loader->amx.call(main, ret);
-        vm_callback_postcall(my_ctx);
+  if (out_size < sizeof(pio_symbols_header))
+    return STATUS_BUFFER_TOO_SMALL;
 
-        if (res != amx::error::success)
-          status = STATUS_UNSUCCESSFUL;
-        else
-          status = (NTSTATUS)ret;
-      }
-    }
+  // the tables are immutable after load, no need to lock
+  const auto loader = ((context*)ctx)->loader;
+  const auto publics_count = loader->get_publics_count();
+  const auto functions_count = loader->get_functions_count();
+  const auto count = publics_count + functions_count;
+
+  const auto header = (pio_symbols_header*)out_buffer;
+  header->symbol_count = (ULONG)count;
+  header->reserved = 0;
+
+  const auto required = sizeof(pio_symbols_header) + count * sizeof(pio_symbol);
+  if (out_size < required) {
+    *written = sizeof(pio_symbols_header);
+    return STATUS_BUFFER_OVERFLOW;
   }
 
-  if (!NT_SUCCESS(status)) {
-    {
-      std::unique_lock lock{my_ctx->mutex};
-      vm_callback_destroyed(my_ctx);
-    }
-    vm_destroy_internal(my_ctx);
-    return status;
+  const auto symbols = (pio_symbol*)(header + 1);
+  const auto set_name = [](pio_symbol& sym, const char* name) {
+    const auto len = std::min(strlen(name), std::size(sym.name) - 1);
+    memcpy(sym.name, name, len);
+    sym.name[len] = 0;
+  };
+  for (size_t i = 0; i < publics_count; ++i) {
+    const auto& pub = loader->get_public_by_index(i);
+    auto& sym = symbols[i];
+    sym = {};
+    sym.codestart = pub.second;
+    sym.is_public = 1;
+    set_name(sym, pub.first);
+  }
+  for (size_t i = 0; i < functions_count; ++i) {
+    const auto& fn = loader->get_function_by_index(i);
+    auto& sym = symbols[publics_count + i];
+    sym = {};
+    sym.codestart = fn.codestart;
+    sym.codeend = fn.codeend;
+    set_name(sym, fn.name);
   }
 
-  *ctx = my_ctx;
-  return status;
+  *written = required;
+  return STATUS_SUCCESS;
 }
 
-NTSTATUS vm_execute_function(PVOID ctx, PVOID in_buffer, SIZE_T in_size, PVOID out_buffer, SIZE_T out_size) {
-  if (in_size < 32)
-    return STATUS_INVALID_PARAMETER;
-  char arr[33];
-  arr[32] = 0;
-  memcpy(arr, in_buffer, 32);
-  if (strlen(arr) == 32)
-    return STATUS_INVALID_PARAMETER;
+#if DBG
+constexpr static size_t k_low_stack_warning_cells = 64;
+#endif
 
-  if (strncmp(arr, "ioctl_", 6) != 0)
-    return STATUS_INVALID_PARAMETER;
+NTSTATUS vm_memory_usage(PVOID ctx, PVOID out_buffer, SIZE_T out_size, SIZE_T* written) {
+  *written = 0;
 
   if (!ctx)
     return STATUS_DEVICE_NOT_READY;
 
-  // call function
+  if (out_size != sizeof(pio_memory_usage))
+    return STATUS_INVALID_PARAMETER;
+
   const auto my_ctx = (context*)ctx;
   const auto loader = my_ctx->loader;
-  const auto fn = loader->get_public(arr);
-  if (!fn)
-    return STATUS_OBJECT_NAME_NOT_FOUND;
-
-  auto& amx = loader->amx;
-
-  const auto cell_in_buffer = (cell*)in_buffer + 4;
-  const auto cell_in_count = in_size / sizeof(cell) - 4;
-  cell cell_in_va{};
+  cell heap_high{}, stack_low{};
+  {
+    std::unique_lock lock{my_ctx->mutex};
+    loader->get_high_water_marks(heap_high, stack_low);
+  }
+  // all instances share the layout, so the marks are the furthest any of them got
+  for (size_t i = 0; i < my_ctx->replica_count; ++i) {
+    const auto replica = my_ctx->replicas[i];
+    std::unique_lock lock{replica->mutex};
+    cell replica_heap_high{}, replica_stack_low{};
+    replica->loader->get_high_water_marks(replica_heap_high, replica_stack_low);
+    heap_high = std::max(heap_high, replica_heap_high);
+    stack_low = std::min(stack_low, replica_stack_low);
+  }
+#if DBG
+  if ((size_t)(stack_low - heap_high) < k_low_stack_warning_cells * sizeof(cell))
+    DbgPrint("[PawnIO] Low on stack: %u bytes were left free\n", (unsigned)(stack_low - heap_high));
+#endif
 
-  const auto cell_out_buffer = (cell*)out_buffer;
-  const auto cell_out_count = out_size / sizeof(cell);
-  cell cell_out_va{};
+  const auto usage = (pio_memory_usage*)out_buffer;
+  usage->data_size = loader->get_data_count() * sizeof(cell);
+  usage->heap_base = loader->get_heap_base_count() * sizeof(cell);
+  usage->stack_top = loader->amx.STP;
+  usage->heap_high_water = heap_high;
+  usage->stack_low_water = stack_low;
 
-  NTSTATUS status = STATUS_SUCCESS;
+  *written = sizeof(pio_memory_usage);
+  return STATUS_SUCCESS;
+}
 
-  {
-    std::unique_lock lock{my_ctx->mutex};
-    if (amx.mem.data().map(cell_in_buffer, cell_in_count, cell_in_va)) {
-      if (amx.mem.data().map(cell_out_buffer, cell_out_count, cell_out_va)) {
-        status = vm_callback_precall(my_ctx, fn);
-        if (NT_SUCCESS(status)) {
-          amx64::cell out{};
-          const auto DAT = loader->amx.DAT;
-          const auto ret = loader->amx.call(fn, out, {cell_in_va - DAT, cell_in_count, cell_out_va - DAT, cell_out_count});
-          vm_callback_postcall(my_ctx);
-          if (ret != amx::error::success) {
-            DbgPrint("[PawnIO] Call to %s failed: %X\n", arr, ret);
-            status = STATUS_UNSUCCESSFUL;
-          } else {
-            status = (NTSTATUS)out;
-          }
-        }
+NTSTATUS vm_memory_tracking(PVOID ctx, bool enable) {
+  if (!ctx)
+    return STATUS_DEVICE_NOT_READY;
 
-        amx.mem.data().unmap(cell_out_va, cell_out_count);
-      } else {
-        status = STATUS_UNSUCCESSFUL;
-      }
-      amx.mem.data().unmap(cell_in_va, cell_in_count);
-    } else {
-      status = STATUS_UNSUCCESSFUL;
-    }
-  }
+  // replicas pick the setting up when they're next acquired, see vm_pool_acquire
+  const auto my_ctx = (context*)ctx;
+  std::unique_lock lock{my_ctx->mutex};
+  my_ctx->track_memory = enable;
+  vm_update_single_step(my_ctx);
+  return STATUS_SUCCESS;
+}
 
-  return status;
+// How many calls on ctx can run at once without one waiting for another, see vm_pool_acquire. Serial publics can
+// still queue up on the primary behind each other.
+SIZE_T vm_concurrency(PVOID ctx) {
+  if (!ctx)
+    return 1;
+  const auto my_ctx = (context*)ctx;
+  return vm_callback_has_call_hooks() ? 1 : 1 + my_ctx->replica_count;
 }
 
 NTSTATUS vm_destroy(PVOID ctx) {
   if (ctx) {
     const auto my_ctx = (context*)ctx;
+    // the polling and job threads must not call into the module once it's unloading
+    if (my_ctx->ring) {
+      vm_ring_free(my_ctx->ring);
+      my_ctx->ring = nullptr;
+    }
+    if (my_ctx->jobs) {
+      vm_jobs_free(my_ctx->jobs);
+      my_ctx->jobs = nullptr;
+    }
     const auto loader = my_ctx->loader;
     const auto fn = loader->get_public("unload");
     if (fn) {
@@ -915,7 +3182,7 @@ NTSTATUS vm_destroy(PVOID ctx) {
       auto status = vm_callback_precall(my_ctx, fn);
       if (NT_SUCCESS(status)) {
         cell ret{};
-        loader->amx.call(fn, ret);
+        vm_call(my_ctx, fn, ret);
         vm_callback_postcall(my_ctx);
       }
     }
@@ -930,3 +3197,137 @@ NTSTATUS vm_destroy(PVOID ctx) {
 
   return STATUS_SUCCESS;
 }
+
+NTSTATUS vm_log_control(PVOID ctx, const pio_log_control* control) {
+  if (!ctx)
+    return STATUS_DEVICE_NOT_READY;
+
+  const auto my_ctx = (context*)ctx;
+  my_ctx->log_max_per_second = control->max_per_second;
+  my_ctx->log_enabled = control->enabled != 0;
+  return STATUS_SUCCESS;
+}
+
+// Copies a format out of the module's static data. That's never mapped over, so it's read straight from the data
+// segment rather than through translate, without the instance locked; a module rewriting it meanwhile only garbles
+// the text. Fails if the string doesn't end in static data.
+template <size_t N>
+static bool vm_log_read_format(amx64_loader* loader, cell vfmt, char (&fmt)[N]) {
+  if (vfmt % sizeof(cell) != 0)
+    return false;
+  const auto data = loader->get_data();
+  const auto end = loader->get_heap_base_count();
+  const auto first = (size_t)vfmt / sizeof(cell);
+  const auto packed = data[first] > k_unpacked_max;
+  const auto per_cell = packed ? sizeof(cell) : 1;
+  size_t idx = 0;
+  for (size_t i = first; i < end; ++i) {
+    const auto c = data[i];
+    for (size_t j = 0; j < per_cell; ++j) {
+      const auto ch = packed ? amx_packed_char(c, j) : (char)c;
+      fmt[idx] = ch;
+      // anything past N would be truncated anyway
+      if (!ch || ++idx == N - 1) {
+        fmt[idx] = 0;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// Formats a record of ctx's, see vm_log_read_format.
+static void vm_log_render(context* ctx, const vm_log_record& record, char (&text)[k_log_text_size]) {
+  if (record.format == k_log_format_dynamic) {
+    RtlStringCbCopyA(text, sizeof(text), "<format not in static data>");
+    return;
+  }
+
+  char fmt[k_log_text_size];
+  char message[k_log_text_size];
+  size_t arg_count{};
+  if (!vm_log_read_format(ctx->loader, record.format, fmt) || !debug_print_format(message, fmt, arg_count)) {
+    RtlStringCbCopyA(text, sizeof(text), "<invalid format>");
+    return;
+  }
+  if (arg_count > record.arg_count) {
+    // the unformatted text still says what was printed
+    if (record.args_truncated)
+      RtlStringCbPrintfA(text, sizeof(text), "<arguments past %u not kept> %s", (ULONG)k_log_max_args, fmt);
+    else
+      RtlStringCbCopyA(text, sizeof(text), "<missing arguments>");
+    return;
+  }
+
+  // truncation is fine
+  RtlStringCbVPrintfA(text, sizeof(text), message, (va_list)record.args);
+}
+
+NTSTATUS vm_log_query(PVOID ctx, PVOID buffer, SIZE_T in_size, SIZE_T out_size, SIZE_T* written) {
+  *written = 0;
+
+  if (!ctx)
+    return STATUS_DEVICE_NOT_READY;
+
+  if (in_size != sizeof(ULONG64))
+    return STATUS_INVALID_PARAMETER;
+
+  if (out_size < sizeof(pio_log_header))
+    return STATUS_BUFFER_TOO_SMALL;
+
+  const auto my_ctx = (context*)ctx;
+  // input and output share the buffer
+  const auto cursor = *(const ULONG64*)buffer;
+
+  const auto next = (uint64_t)ReadAcquire64(&s_log_sequence) + 1;
+  const auto oldest = next > k_log_entries ? next - k_log_entries : 1;
+  uint64_t sequence = cursor == 0 ? oldest : cursor;
+  if (sequence < oldest)
+    sequence = oldest;
+  // concurrent instances may number their records in a different order than the ring has them, so what's lost is
+  // what the numbers skip over rather than the gaps between neighbours
+  std::unique_lock lock{my_ctx->log_mutex};
+  const auto expected = my_ctx->log_expected;
+  auto highest = expected;
+  uint64_t fresh = 0;
+
+  const auto header = (pio_log_header*)buffer;
+  const auto entries = (pio_log_entry*)(header + 1);
+  const auto max_count = (out_size - sizeof(pio_log_header)) / sizeof(pio_log_entry);
+  size_t count = 0;
+  for (; sequence < next && count < max_count; ++sequence) {
+    const auto& slot = s_log[(size_t)sequence & (k_log_entries - 1)];
+    if (ReadAcquire64(&slot.stamp) != (LONG64)sequence)
+      continue;
+    vm_log_record record;
+    memcpy(&record, (const void*)&slot, sizeof(record));
+    // a writer may have taken the slot while it was copied
+    KeMemoryBarrier();
+    if (ReadAcquire64(&slot.stamp) != (LONG64)sequence || record.vm_id != my_ctx->log_id)
+      continue;
+
+    auto& entry = entries[count++];
+    entry.sequence = sequence;
+    entry.timestamp = record.timestamp;
+    vm_log_render(my_ctx, record, entry.text);
+    if (record.vm_sequence >= expected) {
+      ++fresh;
+      highest = std::max(highest, record.vm_sequence + 1);
+    }
+  }
+  // only ever forward, reading old records again loses nothing
+  my_ctx->log_expected = highest;
+  const auto lost = highest - expected - fresh;
+
+  uint64_t rate_limited = my_ctx->log_rate_limited;
+  for (size_t i = 0; i < my_ctx->replica_count; ++i)
+    rate_limited += my_ctx->replicas[i]->log_rate_limited;
+
+  header->next_sequence = sequence;
+  header->lost_records = lost;
+  header->rate_limited_records = rate_limited;
+  header->record_count = (ULONG)count;
+  header->reserved = 0;
+  *written = sizeof(pio_log_header) + count * sizeof(pio_log_entry);
+  return STATUS_SUCCESS;
+}
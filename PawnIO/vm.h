@@ -50,5 +50,48 @@
 #include "amx_wrapper.h"
 
 NTSTATUS vm_load_binary(PVOID* ctx, PVOID buffer, SIZE_T size);
-NTSTATUS vm_execute_function(PVOID ctx, PVOID in_buffer, SIZE_T in_size, PVOID out_buffer, SIZE_T out_size);
+NTSTATUS vm_execute_function(
+  PVOID ctx,
+  PVOID in_buffer,
+  SIZE_T in_size,
+  PVOID out_buffer,
+  SIZE_T out_size,
+  SIZE_T* written
+);
+NTSTATUS vm_execute_function_by_id(
+  PVOID ctx,
+  PVOID in_buffer,
+  SIZE_T in_size,
+  PVOID out_buffer,
+  SIZE_T out_size,
+  SIZE_T* written
+);
+NTSTATUS vm_log_control(PVOID ctx, const struct pio_log_control* control);
+NTSTATUS vm_log_query(PVOID ctx, PVOID buffer, SIZE_T in_size, SIZE_T out_size, SIZE_T* written);
+NTSTATUS vm_execute_batch(
+  PVOID ctx,
+  PVOID in_buffer,
+  SIZE_T in_size,
+  PVOID out_buffer,
+  SIZE_T out_size,
+  SIZE_T* written
+);
+NTSTATUS vm_ring_init();
+void vm_ring_destroy();
+NTSTATUS vm_ring_cleanup(PVOID ctx);
+NTSTATUS vm_ring_register(PVOID ctx, const struct pio_ring_register* reg);
+NTSTATUS vm_ring_enter(PVOID ctx, ULONG* completed);
+NTSTATUS vm_job_register(PVOID ctx, PVOID in_buffer, SIZE_T in_size, ULONG* job_index);
+NTSTATUS vm_job_unregister(PVOID ctx, ULONG job_index);
+NTSTATUS vm_job_query(PVOID ctx, PVOID out_buffer, SIZE_T out_size, SIZE_T* written);
+NTSTATUS vm_functions_query(PVOID ctx, PVOID out_buffer, SIZE_T out_size, SIZE_T* written);
+NTSTATUS vm_set_instruction_budget(PVOID ctx, uint64_t budget);
+NTSTATUS vm_profile_control(PVOID ctx, bool enable);
+NTSTATUS vm_profile_query(PVOID ctx, PVOID out_buffer, SIZE_T out_size, SIZE_T* written);
+NTSTATUS vm_sampling_control(PVOID ctx, ULONG period_ms);
+NTSTATUS vm_sampling_query(PVOID ctx, PVOID out_buffer, SIZE_T out_size, SIZE_T* written);
+NTSTATUS vm_symbols_query(PVOID ctx, PVOID out_buffer, SIZE_T out_size, SIZE_T* written);
+NTSTATUS vm_memory_usage(PVOID ctx, PVOID out_buffer, SIZE_T out_size, SIZE_T* written);
+NTSTATUS vm_memory_tracking(PVOID ctx, bool enable);
+SIZE_T vm_concurrency(PVOID ctx);
 NTSTATUS vm_destroy(PVOID ctx);